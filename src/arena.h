@@ -0,0 +1,75 @@
+/**
+ *  Memory for data that only lasts a frame
+ *
+ *  Command lists, and anything else built and thrown away within a frame, come from the frame
+ *  arena through std::pmr containers rather than from the heap. Allocating bumps a pointer
+ *  through one block, freeing does nothing, and the whole block is reclaimed at once when the
+ *  frame ends, so the render loop doesn't touch the heap once it has warmed up.
+ *
+ *  If a frame needs more than the block holds, the rest comes from the heap for that frame, and
+ *  at the end of the frame the block is replaced with one twice the size of the most used, so it
+ *  only happens while the arena finds its size. The most any frame has used is kept for the
+ *  diagnostics.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory_resource>
+#include <optional>
+#include <vector>
+
+class FrameArena : public std::pmr::memory_resource
+{
+  public:
+    explicit FrameArena(size_t size) : block(size) { arena.emplace(block.data(), block.size()); }
+
+    // Release everything allocated this frame
+    void reset()
+    {
+        highWater = std::max(highWater, used);
+        if (used > block.size())
+        {
+            // Free the old block first, so the two are never held at once
+            arena.reset();
+            block = std::vector<std::byte>();
+            block.resize(2 * used);
+            grown++;
+        }
+        arena.emplace(block.data(), block.size());
+        used = 0;
+    }
+
+    void printStats()
+    {
+        std::cout << "Frame arena:" << std::endl;
+        std::cout << "    block " << block.size() << " bytes, most used in a frame " << highWater
+                  << " bytes, grown " << grown << " times" << std::endl;
+    }
+
+  private:
+    void *do_allocate(size_t bytes, size_t alignment) override
+    {
+        used += bytes;
+        return arena->allocate(bytes, alignment);
+    }
+
+    // Memory is only reclaimed all at once, by reset
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    std::vector<std::byte> block;
+    // Hands out the block, then the heap once it runs out, and is rebuilt to start over
+    std::optional<std::pmr::monotonic_buffer_resource> arena;
+    size_t used = 0;
+
+    size_t highWater = 0;
+    uint64_t grown = 0;
+};
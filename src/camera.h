@@ -0,0 +1,76 @@
+/**
+ *  Zooming in on an arc of the pitch circle
+ *
+ *  At full scale notes a cent or two apart overlap, so the view can zoom in on an arc and pan
+ *  round the circle. The camera is the angle at the centre of the view and a zoom factor. The
+ *  camera's point on the circle sits at the top of the window at zoom 1, moving towards the
+ *  middle as the view zooms in, and everything else is placed relative to it.
+ *
+ *  Precision is kept by never handing the GPU an absolute angle. Angles are doubles on the CPU,
+ *  and each note's offset from the camera angle is worked out in double precision before being
+ *  sent as a float. Offsets of notes near the middle of the view are small, so keep their full
+ *  float precision however far round the circle the camera is, and a tenth of a cent stays
+ *  steady on screen at any zoom. Shaders find positions from the offset with sin and 1 - cos
+ *  written as 2 sin^2, which stay accurate for small angles.
+ *
+ *  Positions here are in the same units as the shaders before the aspect ratio correction.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include "mapping.h"
+
+struct Camera
+{
+    static constexpr double maxZoom = 10000.0;
+    static constexpr double radius = 0.8; // radius of the pitch circle at zoom 1
+
+    double angle = 0.0; // angle at the centre of the view, in [0, 2pi)
+    double zoom = 1.0;
+
+    // Offset of an angle from the camera angle, in [-pi, pi)
+    double offset(double a) const { return signedAngle(a - angle); }
+
+    // Height of the camera's point on the circle
+    double anchor() const { return radius / zoom; }
+
+    // Undo the view for a point on screen, giving where it would be on the unzoomed circle
+    void unproject(double x, double y, double &circleX, double &circleY) const
+    {
+        // Into the camera's frame at zoom 1, with the camera angle at the top
+        double u = x / zoom;
+        double v = (y - anchor()) / zoom + radius;
+
+        // Then turn the camera angle back to where it is on the circle
+        double c = std::cos(angle), s = std::sin(angle);
+        circleX = u * c + v * s;
+        circleY = -u * s + v * c;
+    }
+
+    // Half the angle of the arc that can be on screen, given the aspect ratio scale factors
+    double visibleArc(double scaleX, double scaleY) const
+    {
+        double reach = radius + 1.5 / std::min(scaleX, scaleY);
+        return 2.0 * std::asin(std::min(1.0, reach / (2.0 * radius * zoom)));
+    }
+
+    // Zoom by a factor, keeping the angle under screen position x where it is
+    void zoomAt(double factor, double x)
+    {
+        double fixed = angle + std::asin(std::clamp(x / (radius * zoom), -1.0, 1.0));
+        zoom = std::clamp(zoom * factor, 1.0, maxZoom);
+        angle = wrapAngle(fixed - std::asin(std::clamp(x / (radius * zoom), -1.0, 1.0)));
+    }
+
+    // Turn the view by a distance on screen
+    void pan(double dx) { angle = wrapAngle(angle + dx / (radius * zoom)); }
+
+    void reset()
+    {
+        angle = 0.0;
+        zoom = 1.0;
+    }
+};
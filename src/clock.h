@@ -0,0 +1,120 @@
+/**
+ *  Following incoming MIDI clock, to lock animation to the music
+ *
+ *  MIDI clock sends 24 ticks per beat, but they reach us with jitter from the sender, the
+ *  transport and our own polling, and sometimes in bursts. Tick times are smoothed by an
+ *  alpha-beta tracking filter, a simple phase-locked loop: each tick's arrival is compared
+ *  with where the loop predicted it, and a small fraction of the error corrects the phase
+ *  (alpha) and a smaller fraction the tick period (beta). The animation then reads beats off
+ *  the loop's estimate, which advances smoothly between ticks.
+ *
+ *  Ticks come out of the jitter buffer with latency compensated times, up to the largest port
+ *  latency after they arrive (see merge.h), so beats must be read on the same compensated clock.
+ *  Read on the arrival clock, the estimate would reach the next tick before it came out and
+ *  stall there, then step.
+ *
+ *  Start resets to beat 0, song position pointer jumps to a position, and stop freezes the
+ *  beat count until clock resumes.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include <libremidi/libremidi.hpp>
+
+class ClockSync
+{
+  public:
+    // Loop gains for phase and period corrections
+    static constexpr double alpha = 0.1;
+    static constexpr double beta = 0.005;
+
+    // Ticks further apart than this many periods mean the clock stopped and restarted
+    static constexpr double dropoutPeriods = 8.0;
+
+    // Handle clock, transport and song position messages; returns false for anything else
+    bool handle(const libremidi::message &m)
+    {
+        switch (m.bytes[0])
+        {
+        case 0xF8:
+            tick(m.timestamp);
+            return true;
+        case 0xFA:
+            // Start: the next tick is the first of beat 0
+            ticks = -1;
+            running = true;
+            return true;
+        case 0xFB:
+            running = true;
+            return true;
+        case 0xFC:
+            // Stop: hold the beat count where it is
+            stoppedBeats = beats(m.timestamp);
+            running = false;
+            return true;
+        case 0xF2:
+            if (m.bytes.size() >= 3)
+            {
+                // Song position counts sixteenth notes, six ticks each
+                ticks = 6 * (m.bytes[1] | m.bytes[2] << 7) - 1;
+                stoppedBeats = (ticks + 1) / 24.0;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    // Whether the loop is following a running clock
+    bool locked() const { return running && numTicks >= 2; }
+
+    // Smoothed position in beats at time now
+    double beats(int64_t now) const
+    {
+        if (!locked())
+        {
+            return stoppedBeats;
+        }
+        // Don't run on past where the next tick is due, so a late tick doesn't jump backwards,
+        // nor back before the latest tick, which an early one would otherwise do
+        double sinceTick = std::clamp((now - predicted) / period, 0.0, 1.0);
+        return (ticks + sinceTick) / 24.0;
+    }
+
+    // Smoothed tempo in beats per minute
+    double bpm() const { return 60e9 / (24.0 * period); }
+
+  private:
+    void tick(int64_t time)
+    {
+        ticks++;
+        if (numTicks == 0 || time - predicted > dropoutPeriods * period)
+        {
+            // First tick, or first after a dropout: restart the loop at this tick
+            predicted = time;
+            numTicks = numTicks == 0 ? 1 : 2;
+            return;
+        }
+        if (numTicks == 1)
+        {
+            period = time - predicted;
+            predicted = time;
+            numTicks = 2;
+            return;
+        }
+        double predictedNow = predicted + period;
+        double error = time - predictedNow;
+        predicted = predictedNow + alpha * error;
+        period += beta * error;
+    }
+
+    bool running = true;
+    int numTicks = 0;
+    int64_t ticks = -1;        // ticks since beat 0
+    double predicted = 0;      // filtered time of the latest tick
+    double period = 20833333;  // filtered nanoseconds per tick, 120 bpm to begin with
+    double stoppedBeats = 0.0; // beat count shown while not locked
+};
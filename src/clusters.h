@@ -0,0 +1,215 @@
+/**
+ *  Drawing near-coincident notes as one node
+ *
+ *  A dense microtonal cluster, several notes within a few cents of each other, draws as a pile of
+ *  discs on one spot with edges between them too short to see, and a full set of overlapping
+ *  edges from each to every other note. With --cluster, notes within a threshold of each other
+ *  are drawn as one node instead, with a disc whose area grows with the number of notes in it,
+ *  and one edge is drawn per pair of nodes, so the edge count follows the distinct pitches
+ *  rather than the voices.
+ *
+ *  Clusters are kept up to date as notes start and stop, rather than worked out every frame. A
+ *  new note joins the cluster whose first note is nearest in pitch, if within the threshold, and
+ *  otherwise starts its own. A cluster is drawn with the glide of its first note, and when that
+ *  note stops the next oldest member takes over. A pitch bend moves the notes of its channel
+ *  into whatever clusters they now belong in, and a tuning change reclusters everything.
+ *
+ *  Nodes are numbered in the order of their first notes' slots, which is the order their
+ *  keyframes are uploaded in (see PitchGlides::upload).
+ */
+
+#pragma once
+
+#include <cmath>
+
+#include "glide.h"
+#include "tuning.h"
+#include "voices.h"
+
+class NoteClusters : public VoiceListener
+{
+  public:
+    NoteClusters(const TuningTable &tuning, const PitchGlides &glides, const Voices &voices,
+                 double thresholdCents)
+        : tuning(tuning), glides(glides), voices(voices), threshold(thresholdCents)
+    {
+        for (int slot = 0; slot < maxNotes; slot++)
+        {
+            clusterOf[slot] = -1;
+            count[slot] = 0;
+        }
+        renumber();
+    }
+
+    void voiceOn(int slot, const Voice &voice, int64_t time) override
+    {
+        // Rebuilding takes in the new note, as it is already sounding
+        if (tuning.generation != builtGeneration)
+        {
+            rebuild();
+        }
+        else
+        {
+            add(slot);
+        }
+        renumber();
+    }
+
+    void voiceOff(int slot, const Voice &voice, int64_t time) override
+    {
+        remove(slot);
+        renumber();
+    }
+
+    // Move the notes of a source's channel into the clusters they belong in after a pitch bend
+    void pitchBend(int source, int channel)
+    {
+        int moved[maxNotes];
+        int n = 0;
+        for (int slot = 0; slot < maxNotes; slot++)
+        {
+            const Voice &v = voices[slot];
+            if (clusterOf[slot] >= 0 && v.source == source && v.channel == channel)
+            {
+                remove(slot);
+                moved[n++] = slot;
+            }
+        }
+        for (int i = 0; i < n; i++)
+        {
+            add(moved[i]);
+        }
+        if (n > 0)
+        {
+            renumber();
+        }
+    }
+
+    // Number of nodes drawn
+    int size() const { return numNodes; }
+
+    // Whether a slot's glide is the one its node is drawn with
+    bool shown(int slot) const { return clusterOf[slot] == slot; }
+
+    // Node a sounding slot is drawn as
+    int node(int slot) const { return nodeOf[clusterOf[slot]]; }
+
+    // Number of notes in each node, in node order, padded with ones to maxNotes
+    const float *multiplicities() const { return multiplicity; }
+
+  private:
+    // Pitch of a slot's note in cents, with its channel's bend
+    double pitch(int slot) const
+    {
+        return 1200.0 * std::log2(glides.frequency(voices[slot]) / 440.0);
+    }
+
+    void add(int slot)
+    {
+        cents[slot] = pitch(slot);
+        int nearest = -1;
+        for (int first = 0; first < maxNotes; first++)
+        {
+            if (count[first] == 0)
+            {
+                continue;
+            }
+            double distance = std::abs(cents[first] - cents[slot]);
+            if (distance <= threshold &&
+                (nearest < 0 || distance < std::abs(cents[nearest] - cents[slot])))
+            {
+                nearest = first;
+            }
+        }
+        if (nearest < 0)
+        {
+            nearest = slot;
+        }
+        clusterOf[slot] = nearest;
+        count[nearest]++;
+    }
+
+    void remove(int slot)
+    {
+        int first = clusterOf[slot];
+        if (first < 0)
+        {
+            return;
+        }
+        clusterOf[slot] = -1;
+        count[first]--;
+        if (first != slot || count[first] == 0)
+        {
+            return;
+        }
+
+        // The first note has gone, so the oldest remaining member takes over the cluster
+        int next = -1;
+        for (int s = 0; s < maxNotes; s++)
+        {
+            if (clusterOf[s] == first && (next < 0 || voices[s].onset < voices[next].onset))
+            {
+                next = s;
+            }
+        }
+        for (int s = 0; s < maxNotes; s++)
+        {
+            if (clusterOf[s] == first)
+            {
+                clusterOf[s] = next;
+            }
+        }
+        count[next] = count[first];
+        count[first] = 0;
+    }
+
+    // Cluster every sounding note again from scratch, after the tuning changes
+    void rebuild()
+    {
+        for (int slot = 0; slot < maxNotes; slot++)
+        {
+            clusterOf[slot] = -1;
+            count[slot] = 0;
+        }
+        for (int slot = 0; slot < maxNotes; slot++)
+        {
+            if (voices[slot].active)
+            {
+                add(slot);
+            }
+        }
+        builtGeneration = tuning.generation;
+    }
+
+    // Number the nodes in slot order, and note how many notes each holds
+    void renumber()
+    {
+        numNodes = 0;
+        for (int slot = 0; slot < maxNotes; slot++)
+        {
+            nodeOf[slot] = -1;
+            multiplicity[slot] = 1.0f;
+        }
+        for (int slot = 0; slot < maxNotes; slot++)
+        {
+            if (shown(slot))
+            {
+                multiplicity[numNodes] = count[slot];
+                nodeOf[slot] = numNodes++;
+            }
+        }
+    }
+
+    const TuningTable &tuning;
+    const PitchGlides &glides;
+    const Voices &voices;
+    double threshold;
+    uint64_t builtGeneration = 0;
+
+    int clusterOf[maxNotes]; // slot of the cluster's first note, or -1 if not sounding
+    int count[maxNotes];     // notes in the cluster a slot is first in
+    double cents[maxNotes];  // pitch of each slot when it was clustered
+    int nodeOf[maxNotes];    // node of the cluster a slot is first in
+    float multiplicity[maxNotes];
+    int numNodes = 0;
+};
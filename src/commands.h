@@ -0,0 +1,298 @@
+/**
+ *  Recording draws, then issuing them with as few GL calls as possible
+ *
+ *  Passes don't call GL themselves. Each records its draws into the frame's command list, every
+ *  command naming all the state it needs: tile, program, vertex array, texture, and at most one
+ *  uniform. Once the frame is recorded the list is sorted, so draws sharing a program, vertex
+ *  array and texture follow one another, and issued through a shadow copy of GL's state, so
+ *  nothing is bound or set that already is. The shadow copy lasts from frame to frame, so a
+ *  uniform that hasn't changed since the last frame isn't set again either. The list itself
+ *  lasts only the frame, and lives in the frame arena.
+ *
+ *  Draws are only reordered within a layer, and layers are drawn in order from the back, so what
+ *  is drawn over what never changes. Tiles don't overlap, so the draws of every tile in a layer
+ *  share one bind of each program.
+ *
+ *  GL calls made and state changes skipped are counted for the diagnostics.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory_resource>
+#include <tuple>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "debug.h"
+#include "renderer.h"
+#include "tiles.h"
+
+// What a draw belongs to, drawn in this order
+enum class Layer
+{
+    Circle,
+    Edges,
+    Notes,
+    Intervals,
+    LatticeEdges,
+    LatticeNodes
+};
+
+// Names of the layers, for debug groups
+static const char *layerNames[] = {"Circle",    "Edges",          "Notes",
+                                   "Intervals", "Lattice edges", "Lattice nodes"};
+
+struct DrawCommand
+{
+    Layer layer;
+    int tile;
+    unsigned int program;
+    unsigned int vertexArray;
+    unsigned int texture; // bound to unit 0, or 0 if the program samples none
+    DrawCall call;
+
+    // Uniform set before drawing unless the location is -1, a float array or a single vec4
+    int uniform = -1;
+    bool vec4 = false;
+    int uniformSize = 0;      // floats
+    size_t uniformOffset = 0; // into the list's uniform data
+
+    int sequence = 0; // order recorded, so sorting is repeatable
+};
+
+// Shadow copy of the GL state draws set, lasting from frame to frame, which only passes changes
+// on to GL
+class StateCache
+{
+  public:
+    // Draw into tile i, binding its uniforms again as they move every frame on some renderers
+    void useTile(Renderer &renderer, const TileLayout &layout, int i)
+    {
+        int v[4];
+        layout.viewport(i, v[0], v[1], v[2], v[3]);
+        if (change(viewport, v, sizeof(v)))
+        {
+            glViewport(v[0], v[1], v[2], v[3]);
+        }
+        renderer.useTile(i);
+        calls++;
+    }
+
+    void useProgram(unsigned int p)
+    {
+        if (change(&program, &p, sizeof(p)))
+        {
+            glUseProgram(p);
+        }
+    }
+
+    void bindVertexArray(unsigned int v)
+    {
+        if (change(&vertexArray, &v, sizeof(v)))
+        {
+            glBindVertexArray(v);
+        }
+    }
+
+    // Bind a texture to unit 0
+    void bindTexture(unsigned int t)
+    {
+        if (change(&texture, &t, sizeof(t)))
+        {
+            glBindTexture(GL_TEXTURE_2D, t);
+        }
+    }
+
+    // Set a float array uniform of the program in use, or size / 4 vec4s if vec4 is set
+    void setUniform(int location, const float *values, int size, bool vec4)
+    {
+        ShadowUniform *shadow = std::find_if(uniforms, uniforms + numUniforms, [&](auto &u) {
+            return u.program == program && u.location == location;
+        });
+        if (shadow == uniforms + numUniforms && numUniforms < maxUniforms)
+        {
+            *shadow = ShadowUniform{program, location, -1, {}};
+            numUniforms++;
+        }
+        // Uniforms too large or too many to shadow are always set
+        bool shadowed = shadow != uniforms + maxUniforms && size <= maxUniformFloats;
+        if (shadowed && shadow->size == size && std::equal(values, values + size, shadow->values))
+        {
+            skipped++;
+            return;
+        }
+        if (shadowed)
+        {
+            shadow->size = size;
+            std::copy(values, values + size, shadow->values);
+        }
+        if (vec4)
+        {
+            glUniform4fv(location, size / 4, values);
+        }
+        else
+        {
+            glUniform1fv(location, size, values);
+        }
+        calls++;
+    }
+
+    void draw(const DrawCall &call)
+    {
+        if (call.indexed)
+        {
+            glDrawElements(call.mode, call.count, GL_UNSIGNED_INT, 0);
+        }
+        else if (call.instances == 1)
+        {
+            glDrawArrays(call.mode, 0, call.count);
+        }
+        else
+        {
+            glDrawArraysInstanced(call.mode, 0, call.count, call.instances);
+        }
+        draws++;
+        calls++;
+    }
+
+    void endFrame() { frames++; }
+
+    // Forget the shadow state, after GL state has been changed other than through the cache
+    void invalidate()
+    {
+        program = vertexArray = texture = unknown;
+        std::fill(std::begin(viewport), std::end(viewport), -1);
+        numUniforms = 0;
+    }
+
+    void printStats()
+    {
+        std::cout << "GL commands:" << std::endl;
+        if (frames == 0)
+        {
+            return;
+        }
+        std::cout << "    per frame: " << (double)draws / frames << " draws, "
+                  << (double)calls / frames << " GL calls, " << (double)skipped / frames
+                  << " redundant state changes skipped" << std::endl;
+    }
+
+  private:
+    static constexpr unsigned int unknown = ~0u;
+    static constexpr int maxUniforms = 16;
+    static constexpr int maxUniformFloats = 64;
+
+    // Last value set for a uniform of a program, held in place so the cache never allocates
+    struct ShadowUniform
+    {
+        unsigned int program;
+        int location;
+        int size; // floats, or -1 before the uniform is first set
+        float values[maxUniformFloats];
+    };
+
+    // Copy a new value over the shadow state, returning whether it differed and so needs setting
+    bool change(void *shadow, const void *value, size_t size)
+    {
+        if (std::memcmp(shadow, value, size) == 0)
+        {
+            skipped++;
+            return false;
+        }
+        std::memcpy(shadow, value, size);
+        calls++;
+        return true;
+    }
+
+    unsigned int program = unknown;
+    unsigned int vertexArray = unknown;
+    unsigned int texture = unknown;
+    int viewport[4] = {-1, -1, -1, -1};
+    ShadowUniform uniforms[maxUniforms];
+    int numUniforms = 0;
+
+    uint64_t frames = 0;
+    uint64_t draws = 0;
+    uint64_t calls = 0;
+    uint64_t skipped = 0;
+};
+
+// One frame's draws, held in memory that only lasts the frame (see arena.h)
+class CommandList
+{
+  public:
+    explicit CommandList(std::pmr::memory_resource *memory) : commands(memory), uniformData(memory)
+    {
+    }
+
+    // Record a draw, unless it would draw nothing
+    void add(DrawCommand command)
+    {
+        if (command.call.count == 0 || command.call.instances == 0)
+        {
+            return;
+        }
+        command.sequence = commands.size();
+        commands.push_back(command);
+    }
+
+    // Record a draw which first sets a float array uniform, or a vec4 if vec4 is set
+    void add(DrawCommand command, int location, const float *values, int size, bool vec4 = false)
+    {
+        command.uniform = location;
+        command.vec4 = vec4;
+        command.uniformSize = size;
+        command.uniformOffset = uniformData.size();
+        uniformData.insert(uniformData.end(), values, values + size);
+        add(command);
+    }
+
+    // Issue everything recorded, drawing each tile into its viewport
+    void submit(Renderer &renderer, const TileLayout &layout, StateCache &state)
+    {
+        std::sort(commands.begin(), commands.end(), [](const DrawCommand &a, const DrawCommand &b) {
+            return std::tie(a.layer, a.program, a.vertexArray, a.texture, a.tile, a.sequence) <
+                   std::tie(b.layer, b.program, b.vertexArray, b.texture, b.tile, b.sequence);
+        });
+
+        for (size_t i = 0; i < commands.size(); i++)
+        {
+            const DrawCommand &c = commands[i];
+            if (i == 0 || c.layer != commands[i - 1].layer)
+            {
+                if (i != 0)
+                    popDebugGroup();
+                pushDebugGroup(layerNames[(int)c.layer]);
+            }
+            if (i == 0 || c.tile != commands[i - 1].tile)
+            {
+                state.useTile(renderer, layout, c.tile);
+            }
+            state.useProgram(c.program);
+            state.bindVertexArray(c.vertexArray);
+            if (c.texture != 0)
+            {
+                state.bindTexture(c.texture);
+            }
+            if (c.uniform != -1)
+            {
+                state.setUniform(c.uniform, uniformData.data() + c.uniformOffset, c.uniformSize,
+                                 c.vec4);
+            }
+            state.draw(c.call);
+        }
+        if (!commands.empty())
+        {
+            popDebugGroup();
+        }
+        state.endFrame();
+    }
+
+  private:
+    std::pmr::vector<DrawCommand> commands;
+    std::pmr::vector<float> uniformData; // uniform values of the draws, end to end
+};
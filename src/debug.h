@@ -0,0 +1,155 @@
+/**
+ *  Names and messages for GL debugging tools, in debug builds only
+ *
+ *  With KHR_debug (core since GL 4.3, and an extension on older desktop drivers and GLES) every
+ *  program, buffer, vertex array and texture is given a name, and each layer of the frame is
+ *  wrapped in a debug group, so apitrace and RenderDoc show the edges being drawn by the line
+ *  program rather than bare object numbers. Messages from the driver, performance warnings
+ *  included, are printed from the call that caused them, as a debug context is asked for.
+ *
+ *  With NDEBUG defined all of this compiles to empty inline functions, so release builds make no
+ *  extra calls. Without KHR_debug the functions do nothing.
+ */
+
+#pragma once
+
+#include <iostream>
+#include <string>
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#ifndef GL_DEBUG_OUTPUT
+#define GL_DEBUG_OUTPUT 0x92E0
+#define GL_DEBUG_OUTPUT_SYNCHRONOUS 0x8242
+#define GL_DEBUG_SOURCE_APPLICATION 0x824A
+#define GL_DEBUG_TYPE_ERROR 0x824C
+#define GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR 0x824D
+#define GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR 0x824E
+#define GL_DEBUG_TYPE_PORTABILITY 0x824F
+#define GL_DEBUG_TYPE_PERFORMANCE 0x8250
+#define GL_DEBUG_TYPE_PUSH_GROUP 0x8269
+#define GL_DEBUG_TYPE_POP_GROUP 0x826A
+#define GL_DEBUG_SEVERITY_NOTIFICATION 0x826B
+#define GL_BUFFER 0x82E0
+#define GL_PROGRAM 0x82E2
+#endif
+
+#ifndef NDEBUG
+
+static void(APIENTRY *debugObjectLabel)(GLenum, GLuint, GLsizei, const GLchar *) = nullptr;
+static void(APIENTRY *debugPushGroup)(GLenum, GLuint, GLsizei, const GLchar *) = nullptr;
+static void(APIENTRY *debugPopGroup)() = nullptr;
+
+// Load a KHR_debug function, by its core name or with the KHR suffix GLES uses
+template <typename F> bool loadDebugFunction(F &f, const std::string &name)
+{
+    f = (F)glfwGetProcAddress(name.c_str());
+    if (f == nullptr)
+    {
+        f = (F)glfwGetProcAddress((name + "KHR").c_str());
+    }
+    return f != nullptr;
+}
+
+// Print a message from the driver
+inline void APIENTRY printDebugMessage(GLenum source, GLenum type, GLuint id, GLenum severity,
+                                       GLsizei length, const GLchar *message, const void *user)
+{
+    const char *kind = "OTHER";
+    switch (type)
+    {
+    case GL_DEBUG_TYPE_ERROR:
+        kind = "ERROR";
+        break;
+    case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR:
+        kind = "DEPRECATED";
+        break;
+    case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:
+        kind = "UNDEFINED_BEHAVIOR";
+        break;
+    case GL_DEBUG_TYPE_PORTABILITY:
+        kind = "PORTABILITY";
+        break;
+    case GL_DEBUG_TYPE_PERFORMANCE:
+        kind = "PERFORMANCE";
+        break;
+    }
+    std::cout << "GL::" << kind << " " << id << ": " << message << std::endl;
+}
+
+#endif
+
+// Ask for a debug context, so the driver checks calls and reports problems
+inline void requestDebugContext()
+{
+#ifndef NDEBUG
+    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
+#endif
+}
+
+// Start printing driver messages, once the context is current and glad is loaded
+inline void setupDebugOutput()
+{
+#ifndef NDEBUG
+    if (!glfwExtensionSupported("GL_KHR_debug"))
+    {
+        std::cout << "GL debug output: KHR_debug not supported" << std::endl;
+        return;
+    }
+    void(APIENTRY * messageCallback)(GLDEBUGPROC, const void *) = nullptr;
+    void(APIENTRY * messageControl)(GLenum, GLenum, GLenum, GLsizei, const GLuint *,
+                                    GLboolean) = nullptr;
+    if (!loadDebugFunction(messageCallback, "glDebugMessageCallback") ||
+        !loadDebugFunction(messageControl, "glDebugMessageControl") ||
+        !loadDebugFunction(debugObjectLabel, "glObjectLabel") ||
+        !loadDebugFunction(debugPushGroup, "glPushDebugGroup") ||
+        !loadDebugFunction(debugPopGroup, "glPopDebugGroup"))
+    {
+        debugObjectLabel = nullptr;
+        debugPushGroup = nullptr;
+        debugPopGroup = nullptr;
+        return;
+    }
+
+    glEnable(GL_DEBUG_OUTPUT);
+    // Deliver messages from inside the offending call, so they can be traced back to it
+    glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+    messageCallback(printDebugMessage, nullptr);
+    // Leave out notifications, which report every buffer allocation, and our own group markers
+    messageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, nullptr,
+                   GL_FALSE);
+    messageControl(GL_DEBUG_SOURCE_APPLICATION, GL_DEBUG_TYPE_PUSH_GROUP, GL_DONT_CARE, 0,
+                   nullptr, GL_FALSE);
+    messageControl(GL_DEBUG_SOURCE_APPLICATION, GL_DEBUG_TYPE_POP_GROUP, GL_DONT_CARE, 0,
+                   nullptr, GL_FALSE);
+    std::cout << "GL debug output enabled" << std::endl;
+#endif
+}
+
+// Name an object for debugging tools: identifier is GL_BUFFER, GL_PROGRAM, GL_VERTEX_ARRAY or
+// GL_TEXTURE, and the object must have been bound or created already
+inline void labelObject(GLenum identifier, unsigned int name, const char *label)
+{
+#ifndef NDEBUG
+    if (debugObjectLabel != nullptr)
+        debugObjectLabel(identifier, name, -1, label);
+#endif
+}
+
+// Start a named group of calls for debugging tools, ended by popDebugGroup
+inline void pushDebugGroup(const char *name)
+{
+#ifndef NDEBUG
+    if (debugPushGroup != nullptr)
+        debugPushGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, name);
+#endif
+}
+
+inline void popDebugGroup()
+{
+#ifndef NDEBUG
+    if (debugPopGroup != nullptr)
+        debugPopGroup();
+#endif
+}
@@ -0,0 +1,108 @@
+/**
+ *  Choosing the monitor and how frames are presented
+ *
+ *  Windowed, the desktop compositor holds each frame back until its next refresh and can drop
+ *  frames under load. Fullscreen on a monitor, the window uses the monitor's current video mode,
+ *  so there is no mode switch, and on most platforms bypasses the compositor.
+ *
+ *  Buffer swaps can wait for the display's vertical blank (vsync), skip it only when a frame is
+ *  late (adaptive, where the driver supports tearing swaps), or not wait at all (off, lowest
+ *  latency, may tear). Variable refresh rate displays (G-Sync, FreeSync) are driven by the
+ *  platform: with a fullscreen window and vsync off or adaptive, a driver with variable refresh
+ *  enabled shows each frame as it is finished. GLFW gives no control over it beyond that.
+ */
+
+#pragma once
+
+#include <iostream>
+
+#include <GLFW/glfw3.h>
+
+// How buffer swaps wait for the display
+enum class SwapMode
+{
+    Default, // whatever the driver does by default, usually vsync
+    VSync,
+    Adaptive,
+    Off
+};
+
+// Monitor to go fullscreen on, by its number in the list printed, or the primary monitor for -1
+inline GLFWmonitor *chooseMonitor(int index)
+{
+    int count;
+    GLFWmonitor **monitors = glfwGetMonitors(&count);
+    std::cout << "Monitors:" << std::endl;
+    for (int i = 0; i < count; i++)
+    {
+        const GLFWvidmode *mode = glfwGetVideoMode(monitors[i]);
+        std::cout << i << ": " << glfwGetMonitorName(monitors[i]) << ", " << mode->width << "x"
+                  << mode->height << " at " << mode->refreshRate << " Hz" << std::endl;
+    }
+    std::cout << std::endl;
+
+    if (index < 0)
+    {
+        return glfwGetPrimaryMonitor();
+    }
+    if (index >= count)
+    {
+        std::cout << "ERROR::DISPLAY::NO_SUCH_MONITOR " << index << std::endl;
+        glfwTerminate();
+        exit(-1);
+    }
+    return monitors[index];
+}
+
+// Ask for a fullscreen window in the monitor's current video mode, so it isn't changed
+inline void matchVideoMode(GLFWmonitor *monitor)
+{
+    const GLFWvidmode *mode = glfwGetVideoMode(monitor);
+    glfwWindowHint(GLFW_RED_BITS, mode->redBits);
+    glfwWindowHint(GLFW_GREEN_BITS, mode->greenBits);
+    glfwWindowHint(GLFW_BLUE_BITS, mode->blueBits);
+    glfwWindowHint(GLFW_REFRESH_RATE, mode->refreshRate);
+}
+
+// Set how buffer swaps wait for the display, with the window's context current, returning the
+// mode actually used
+inline SwapMode applySwapMode(SwapMode swap)
+{
+    if (swap == SwapMode::Adaptive && !glfwExtensionSupported("WGL_EXT_swap_control_tear") &&
+        !glfwExtensionSupported("GLX_EXT_swap_control_tear"))
+    {
+        std::cout << "Adaptive vsync isn't supported here, using vsync" << std::endl;
+        swap = SwapMode::VSync;
+    }
+    switch (swap)
+    {
+    case SwapMode::VSync:
+        glfwSwapInterval(1);
+        break;
+    case SwapMode::Adaptive:
+        glfwSwapInterval(-1);
+        break;
+    case SwapMode::Off:
+        glfwSwapInterval(0);
+        break;
+    default:
+        break;
+    }
+    return swap;
+}
+
+// Print the monitor shown on, its refresh rate and how frames are presented
+inline void reportDisplay(GLFWwindow *window, SwapMode swap)
+{
+    GLFWmonitor *monitor = glfwGetWindowMonitor(window);
+    bool fullscreen = monitor != NULL;
+    if (!fullscreen)
+    {
+        monitor = glfwGetPrimaryMonitor();
+    }
+    const GLFWvidmode *mode = glfwGetVideoMode(monitor);
+    const char *present[] = {"driver default", "vsync", "adaptive vsync", "immediate"};
+    std::cout << "Display: " << (fullscreen ? "fullscreen on " : "windowed, primary monitor ")
+              << glfwGetMonitorName(monitor) << " at " << mode->refreshRate << " Hz, present mode "
+              << present[(int)swap] << std::endl;
+}
@@ -0,0 +1,250 @@
+/**
+ *  Handing rendered frames to other programs through shared memory
+ *
+ *  For streaming, a compositor on the same machine can take chordagon's frames straight from
+ *  shared memory rather than capturing the window. Each frame is read back from the GPU into
+ *  one of a few pixel buffer objects, and a frame or two later, once the GPU has finished with
+ *  it, copied into the next slot of a ring in shared memory. Nothing ever waits: if the read of
+ *  an earlier frame hasn't finished by the time its buffer is needed again, the new frame is
+ *  dropped, and readers take no locks.
+ *
+ *  Each slot has a sequence number which is odd while the slot is being written and even once
+ *  it holds a complete frame, and the header has the number of the latest complete frame, so a
+ *  reader always finds the newest frame and can tell if it was overwritten while being copied.
+ *
+ *  Shared memory layout, all integers little-endian:
+ *      header      64 bytes
+ *          0       "CHRDFRAM"
+ *          8       u32 version
+ *          12      u32 slot count
+ *          16      u32 maximum width, u32 maximum height
+ *          24      u32 header size, the offset of the first slot
+ *          28      u32 slot size, including the slot's own header
+ *          32      u64 latest, the number of frames published so far; frame n (from 1) is in
+ *                  slot (n - 1) % slot count
+ *      slot        64 byte header, then pixels
+ *          0       u64 sequence, 2n - 1 while frame n is being written and 2n once complete
+ *          8       u32 width, u32 height, u32 stride in bytes
+ *          20      u32 format, always 0 for RGBA 8 bits per channel, bottom row first
+ *          24      i64 time the frame was drawn (ns, steady clock)
+ *
+ *  To read the newest frame: load latest (acquire), n = latest, and load the sequence of its slot
+ *  (acquire). If it isn't 2n the slot is being rewritten, so load latest again. Otherwise copy the
+ *  pixels, and load the sequence again: if it is still 2n the copy is good.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <glad/glad.h>
+
+#include "debug.h"
+
+class FrameSink
+{
+  public:
+    static constexpr uint32_t version = 1;
+    static constexpr int numSlots = 3;
+    static constexpr int numBuffers = 3; // frames being read back at once
+    static constexpr size_t headerSize = 64;
+
+    ~FrameSink() { stop(); }
+
+    // Create the shared memory, with room for frames up to maxWidth x maxHeight
+    bool start(const std::string &name, int maxWidth, int maxHeight)
+    {
+        this->name = name;
+        this->maxWidth = maxWidth;
+        this->maxHeight = maxHeight;
+        slotSize = (headerSize + (size_t)maxWidth * maxHeight * 4 + 63) / 64 * 64;
+        size = headerSize + numSlots * slotSize;
+
+#ifdef _WIN32
+        mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                     (DWORD)(size >> 32), (DWORD)size, name.c_str());
+        if (mapping != NULL)
+            memory = (uint8_t *)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+#else
+        int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+        if (fd >= 0 && ftruncate(fd, size) == 0)
+        {
+            void *m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            memory = m == MAP_FAILED ? nullptr : (uint8_t *)m;
+        }
+        if (fd >= 0)
+            close(fd);
+#endif
+        if (memory == nullptr)
+        {
+            std::cout << "ERROR::FRAMESINK::SHARED_MEMORY_FAILED " << name << std::endl;
+            return false;
+        }
+
+        std::memset(memory, 0, headerSize);
+        std::memcpy(memory, "CHRDFRAM", 8);
+        put32(8, version);
+        put32(12, numSlots);
+        put32(16, maxWidth);
+        put32(20, maxHeight);
+        put32(24, headerSize);
+        put32(28, slotSize);
+
+        glGenBuffers(numBuffers, PBO);
+        for (int i = 0; i < numBuffers; i++)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, PBO[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)maxWidth * maxHeight * 4, NULL,
+                         GL_STREAM_READ);
+            labelObject(GL_BUFFER, PBO[i], "Frame sink read back");
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        std::cout << "Sending frames up to " << maxWidth << "x" << maxHeight
+                  << " to shared memory " << name << std::endl;
+        return true;
+    }
+
+    void stop()
+    {
+        if (memory == nullptr)
+            return;
+        for (Pending &p : pending)
+        {
+            if (p.fence != nullptr)
+            {
+                glDeleteSync(p.fence);
+                p.fence = nullptr;
+            }
+        }
+        glDeleteBuffers(numBuffers, PBO);
+#ifdef _WIN32
+        UnmapViewOfFile(memory);
+        CloseHandle(mapping);
+#else
+        munmap(memory, size);
+        shm_unlink(name.c_str());
+#endif
+        memory = nullptr;
+    }
+
+    // Publish frames whose read back has finished, then start reading back the frame just drawn
+    void capture(int width, int height, int64_t time)
+    {
+        publishFinished();
+
+        if (width > maxWidth || height > maxHeight)
+        {
+            tooLarge++;
+            return;
+        }
+        Pending &p = pending[next];
+        if (p.fence != nullptr)
+        {
+            dropped++;
+            return;
+        }
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, PBO[next]);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        p = Pending{glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), width, height, time};
+        next = (next + 1) % numBuffers;
+    }
+
+    void printStats()
+    {
+        std::cout << "Frame sink:" << std::endl;
+        std::cout << "    frames published: " << published << ", dropped (read back too slow): "
+                  << dropped << ", too large: " << tooLarge << std::endl;
+    }
+
+  private:
+    struct Pending
+    {
+        GLsync fence = nullptr;
+        int width = 0;
+        int height = 0;
+        int64_t time = 0;
+    };
+
+    // Copy finished read backs into the ring, oldest first, without waiting for any
+    void publishFinished()
+    {
+        for (int i = 0; i < numBuffers; i++)
+        {
+            int b = (next + i) % numBuffers;
+            Pending &p = pending[b];
+            if (p.fence == nullptr)
+                continue;
+            GLenum status = glClientWaitSync(p.fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                break;
+            glDeleteSync(p.fence);
+            p.fence = nullptr;
+
+            size_t bytes = (size_t)p.width * p.height * 4;
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, PBO[b]);
+            void *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+            if (pixels != nullptr)
+            {
+                publish(p, pixels, bytes);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+    }
+
+    void publish(const Pending &p, const void *pixels, size_t bytes)
+    {
+        uint64_t n = published + 1;
+        uint8_t *slot = memory + headerSize + ((n - 1) % numSlots) * slotSize;
+        std::atomic_ref<uint64_t> sequence(*(uint64_t *)slot);
+        std::atomic_ref<uint64_t> latest(*(uint64_t *)(memory + 32));
+
+        sequence.store(2 * n - 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(slot + 8, &p.width, 4);
+        std::memcpy(slot + 12, &p.height, 4);
+        uint32_t stride = p.width * 4, format = 0;
+        std::memcpy(slot + 16, &stride, 4);
+        std::memcpy(slot + 20, &format, 4);
+        std::memcpy(slot + 24, &p.time, 8);
+        std::memcpy(slot + headerSize, pixels, bytes);
+        sequence.store(2 * n, std::memory_order_release);
+        latest.store(n, std::memory_order_release);
+        published = n;
+    }
+
+    void put32(size_t offset, uint32_t v) { std::memcpy(memory + offset, &v, 4); }
+
+    std::string name;
+    int maxWidth = 0;
+    int maxHeight = 0;
+    size_t slotSize = 0;
+    size_t size = 0;
+    uint8_t *memory = nullptr;
+#ifdef _WIN32
+    HANDLE mapping = NULL;
+#endif
+
+    unsigned int PBO[numBuffers];
+    Pending pending[numBuffers];
+    int next = 0; // buffer the next frame is read back into
+
+    uint64_t published = 0;
+    uint64_t dropped = 0;
+    uint64_t tooLarge = 0;
+};
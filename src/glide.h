@@ -0,0 +1,225 @@
+/**
+ *  Pitch bends as timestamped keyframes, interpolated by the shaders
+ *
+ *  Pitch bend messages arrive at whatever rate the controller sends them, often well below the
+ *  display's refresh rate and unevenly spaced, so moving a note straight to each new bend looks
+ *  steppy on a fast display. Instead each sounding note holds one keyframe: the angle it is
+ *  gliding from, the angle it is gliding to, and the times the glide starts and ends. A bend
+ *  starts a new glide from wherever the note has got to, lasting about as long as the gap since
+ *  the channel's previous bend, so a stream of bends joins up into continuous motion.
+ *
+ *  The keyframes live in a uniform buffer shared by the point and line shaders, which work out
+ *  each note's angle at the time the frame will be shown. They are only uploaded when a bend
+ *  arrives, a note starts or stops, or the camera moves, so held notes cost nothing from frame
+ *  to frame. Angles are kept in double precision here, and uploaded as offsets from the camera
+ *  angle (see camera.h).
+ *
+ *  Times are in microseconds, wrapping at 32 bits. The shaders only ever look at differences
+ *  between nearby times, which come out right across the wrap.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+#include "camera.h"
+#include "mapping.h"
+#include "tuning.h"
+#include "voices.h"
+
+// A note's glide between two angles, as offsets from the camera angle laid out as a uvec4 for
+// the shaders
+struct Keyframe
+{
+    float from = 0.0f;
+    float to = 0.0f;
+    uint32_t start = 0; // microseconds
+    uint32_t end = 0;
+};
+
+static_assert(sizeof(Keyframe) == 16, "Keyframe must match a std140 uvec4");
+
+// A note's glide between two angles, at full precision
+struct Glide
+{
+    double from = 0.0; // in [0, 2pi)
+    double to = 0.0;   // within half a turn of from, so the glide goes the short way round
+    uint32_t start = 0;
+    uint32_t end = 0;
+
+    // Angle at a time in microseconds
+    double at(uint32_t time) const
+    {
+        double length = std::max((double)(end - start), 1.0);
+        double t = std::clamp((double)(int32_t)(time - start) / length, 0.0, 1.0);
+        return from + (to - from) * t;
+    }
+};
+
+// Timestamp in nanoseconds to the wrapping microseconds used by keyframes
+inline uint32_t keyframeTime(int64_t ns) { return (uint32_t)(ns / 1000); }
+
+class PitchGlides : public VoiceListener
+{
+  public:
+    // Bounds on how long a glide lasts, in nanoseconds
+    static constexpr int64_t minGlideNs = 1000000;
+    static constexpr int64_t maxGlideNs = 40000000;
+
+    PitchGlides(TuningTable &tuning, AngleTable &angles, const Voices &voices)
+        : tuning(tuning), angles(angles), voices(voices)
+    {
+        bend.fill(0);
+        bendRange.fill(2.0);
+        lastBend.fill(0);
+        rpn.fill(0x3FFF);
+    }
+
+    void voiceOn(int slot, const Voice &voice, int64_t time) override
+    {
+        double angle = bentAngle(voice);
+        glides[slot] = Glide{angle, angle, keyframeTime(time), keyframeTime(time)};
+        changed = true;
+    }
+
+    void voiceOff(int slot, const Voice &voice, int64_t time) override { changed = true; }
+
+    // Pitch bend on a channel of a source, as a 14-bit value centred on 8192
+    void pitchBend(int source, int channel, int value, int64_t time)
+    {
+        int c = sourceChannel(source, channel);
+        bend[c] = value - 8192;
+
+        // Glide for as long as bends are arriving apart, so each glide ends as the next begins
+        int64_t length = std::clamp(time - lastBend[c], minGlideNs, maxGlideNs);
+        lastBend[c] = time;
+        retarget(c, time, length);
+    }
+
+    // Follow RPN 0, which sets the pitch bend range in semitones and cents
+    void controlChange(int source, int channel, int controller, int value, int64_t time)
+    {
+        int c = sourceChannel(source, channel);
+        switch (controller)
+        {
+        case 99:
+        case 98:
+            // Selecting an NRPN deselects the RPN, so data entry for it leaves the range alone
+            rpn[c] = 0x3FFF;
+            break;
+        case 101:
+            rpn[c] = (rpn[c] & 0x7F) | value << 7;
+            break;
+        case 100:
+            rpn[c] = (rpn[c] & 0x3F80) | value;
+            break;
+        case 6:
+            if (rpn[c] == 0)
+            {
+                bendRange[c] = value + std::fmod(bendRange[c], 1.0);
+                retarget(c, time, 0);
+            }
+            break;
+        case 38:
+            if (rpn[c] == 0)
+            {
+                bendRange[c] = std::floor(bendRange[c]) + value / 100.0;
+                retarget(c, time, 0);
+            }
+            break;
+        }
+    }
+
+    /**
+     * Copy keyframes of the active voices into out, in the same order as Voices::angles
+     *
+     * Returns false without copying anything if nothing, including the camera angle, has changed
+     * since the last call.
+     */
+    bool upload(Keyframe out[], const Camera &camera)
+    {
+        return upload(out, camera, [](int slot) { return true; });
+    }
+
+    // As upload, but only for the active voices shown(slot) is true for, in slot order
+    template <typename Shown> bool upload(Keyframe out[], const Camera &camera, Shown shown)
+    {
+        if (!changed && camera.angle == uploadedAngle)
+        {
+            return false;
+        }
+        int n = 0;
+        for (int slot = 0; slot < maxNotes; slot++)
+        {
+            if (voices[slot].active && shown(slot))
+            {
+                const Glide &g = glides[slot];
+                double from = camera.offset(g.from);
+                out[n++] = Keyframe{(float)from, (float)(from + g.to - g.from), g.start, g.end};
+            }
+        }
+        changed = false;
+        uploadedAngle = camera.angle;
+        return true;
+    }
+
+    // Angle a voice is gliding to, or resting at
+    double target(int slot) const { return glides[slot].to; }
+
+    // Frequency of a voice with its channel's bend applied
+    double frequency(const Voice &voice) const
+    {
+        int c = sourceChannel(voice.source, voice.channel);
+        double semitones = bendRange[c] * bend[c] / 8192.0;
+        return tuning.cached(voice.channel, voice.note) * std::exp2(semitones / 12.0);
+    }
+
+  private:
+    // Angle of a voice with its channel's bend applied, turned from the angle it started at
+    double bentAngle(const Voice &voice) const
+    {
+        int c = sourceChannel(voice.source, voice.channel);
+        if (bend[c] == 0)
+        {
+            return voice.angle;
+        }
+        double cents = 100.0 * bendRange[c] * bend[c] / 8192.0;
+        return wrapAngle(voice.angle + angles.getMapping().bendAngle(cents));
+    }
+
+    // Start every note on a channel of a source, as numbered by sourceChannel, gliding from
+    // where it is now to its newly bent angle
+    void retarget(int c, int64_t time, int64_t length)
+    {
+        uint32_t start = keyframeTime(time);
+        for (int slot = 0; slot < maxNotes; slot++)
+        {
+            const Voice &v = voices[slot];
+            if (v.active && sourceChannel(v.source, v.channel) == c)
+            {
+                Glide &g = glides[slot];
+                double from = wrapAngle(g.at(start));
+                double to = from + signedAngle(bentAngle(v) - from);
+                g = Glide{from, to, start, keyframeTime(time + length)};
+                changed = true;
+            }
+        }
+    }
+
+    TuningTable &tuning;
+    AngleTable &angles;
+    const Voices &voices;
+
+    std::array<Glide, maxNotes> glides{};
+    bool changed = true;
+    double uploadedAngle = 0.0; // camera angle the last upload was relative to
+
+    // Bend state of each channel of each source, indexed by sourceChannel
+    std::array<int, maxSources * 16> bend;         // -8192 to 8191
+    std::array<double, maxSources * 16> bendRange; // semitones either way
+    std::array<int64_t, maxSources * 16> lastBend; // time of the previous bend
+    std::array<int, maxSources * 16> rpn;          // selected registered parameter, 0x3FFF for none
+};
@@ -0,0 +1,232 @@
+/**
+ *  Filtering of incoming midi messages before they reach the message queue
+ *
+ *  Each port has a mask of the message types it accepts. Anything else is counted and dropped
+ *  in the midi callback, so clock, active sensing and SysEx floods never take up queue slots.
+ *  Types which libremidi can ignore itself (SysEx, timing and active sensing) are also switched
+ *  off in the port's input configuration, so they don't even reach the callback.
+ *
+ *  Ports can also have duplicate suppression switched on. When a controller shows up on two
+ *  ports, or a thru loop echoes its output back in, every event arrives twice. A small window
+ *  of recent channel messages, hashed by their bytes, lets the callback recognise a copy of an
+ *  event that arrived on a different port a few milliseconds earlier and drop it.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include <libremidi/libremidi.hpp>
+
+// Message types, used as bits in a port's accept mask
+enum MessageType : uint32_t
+{
+    MessageNote = 1 << 0,      // note on and note off
+    MessageControl = 1 << 1,   // control change
+    MessageBend = 1 << 2,      // pitch bend
+    MessagePressure = 1 << 3,  // poly and channel aftertouch
+    MessageProgram = 1 << 4,   // program change
+    MessageSysEx = 1 << 5,     // system exclusive
+    MessageClock = 1 << 6,     // timing clock and MTC quarter frames
+    MessageTransport = 1 << 7, // start, continue, stop, song position and song select
+    MessageSensing = 1 << 8,   // active sensing
+    MessageOther = 1 << 9,     // tune request, reset and undefined system messages
+};
+
+static constexpr int numMessageTypes = 10;
+static constexpr uint32_t allMessageTypes = (1 << numMessageTypes) - 1;
+
+// Names used for message types on the command line and in diagnostics
+static const char *messageTypeNames[numMessageTypes] = {
+    "note",    "cc",    "bend",      "pressure", "program",
+    "sysex",   "clock", "transport", "sensing",  "other",
+};
+
+// Types accepted by default: the ones updateNoteAngles uses
+static constexpr uint32_t defaultAcceptMask = MessageNote | MessageControl | MessageBend;
+
+// Maximum number of midi input ports which can be given their own mask
+static constexpr int maxPorts = 64;
+
+// Accept mask for each port
+static uint32_t portAcceptMasks[maxPorts];
+
+// Number of messages of each type dropped by the filter, across all ports
+static std::atomic<uint64_t> filteredCounts[numMessageTypes];
+
+// Number of accepted messages dropped because the queue was full
+static std::atomic<uint64_t> queueFullCount;
+
+MessageType messageType(const libremidi::message &message)
+{
+    if (message.bytes.empty())
+    {
+        return MessageOther;
+    }
+    uint8_t status = message.bytes[0];
+    switch (status & 0xF0)
+    {
+    case 0x80:
+    case 0x90:
+        return MessageNote;
+    case 0xA0:
+    case 0xD0:
+        return MessagePressure;
+    case 0xB0:
+        return MessageControl;
+    case 0xC0:
+        return MessageProgram;
+    case 0xE0:
+        return MessageBend;
+    }
+    switch (status)
+    {
+    case 0xF0:
+    case 0xF7:
+        return MessageSysEx;
+    case 0xF1:
+    case 0xF8:
+        return MessageClock;
+    case 0xF2:
+    case 0xF3:
+    case 0xFA:
+    case 0xFB:
+    case 0xFC:
+        return MessageTransport;
+    case 0xFE:
+        return MessageSensing;
+    default:
+        return MessageOther;
+    }
+}
+
+/**
+ * Parse a comma separated list of message type names into a mask
+ *
+ * Returns false if any name is not recognised. "all" selects every type.
+ */
+bool parseMessageTypes(const std::string &list, uint32_t &mask)
+{
+    mask = 0;
+    size_t start = 0;
+    while (start <= list.size())
+    {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos)
+            end = list.size();
+        std::string name = list.substr(start, end - start);
+        start = end + 1;
+
+        if (name == "all")
+        {
+            mask |= allMessageTypes;
+            continue;
+        }
+        int i = 0;
+        while (i < numMessageTypes && name != messageTypeNames[i])
+            i++;
+        if (i == numMessageTypes)
+            return false;
+        mask |= 1 << i;
+    }
+    return true;
+}
+
+// Let libremidi drop the types it can before they reach the callback
+void applyIgnoreOptions(libremidi::input_configuration &config, uint32_t acceptMask)
+{
+    config.ignore_sysex = !(acceptMask & MessageSysEx);
+    config.ignore_timing = !(acceptMask & MessageClock);
+    config.ignore_sensing = !(acceptMask & MessageSensing);
+}
+
+// Called from the midi callback; returns whether the message should be queued
+bool acceptMessage(int port, const libremidi::message &message)
+{
+    MessageType type = messageType(message);
+    if (portAcceptMasks[port] & type)
+    {
+        return true;
+    }
+    filteredCounts[std::countr_zero((uint32_t)type)].fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+// Nanoseconds on the steady clock, used to timestamp incoming messages
+int64_t ingestClock()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Ports with duplicate suppression switched on, one bit per port
+static uint64_t dedupPorts = 0;
+
+// Events from different ports closer together than this are treated as copies
+static int64_t dedupWindowNs = 5'000'000;
+
+/**
+ * Window of recent events, one per hash slot
+ *
+ * Each entry packs the event's three bytes, the port it came from and its arrival time in
+ * units of dedupTimeUnitNs. The time wraps after about 12 hours, which is harmless as only
+ * differences within the window are ever compared.
+ */
+static constexpr int dedupSlots = 256;
+static constexpr int64_t dedupTimeUnitNs = 10'000;
+static std::atomic<uint64_t> dedupWindow[dedupSlots];
+
+// Number of events dropped as duplicates
+static std::atomic<uint64_t> duplicateCount;
+
+// Called from the midi callback; returns whether the message repeats one from another port
+bool isDuplicate(int port, const libremidi::message &message, int64_t now)
+{
+    if (!(dedupPorts >> port & 1) || message.bytes.empty() || message.bytes.size() > 3 ||
+        message.bytes[0] >= 0xF0)
+    {
+        return false;
+    }
+
+    uint32_t key = message.bytes[0] << 16;
+    if (message.bytes.size() > 1)
+        key |= message.bytes[1] << 8;
+    if (message.bytes.size() > 2)
+        key |= message.bytes[2];
+    uint32_t time = now / dedupTimeUnitNs;
+    uint64_t entry = (uint64_t)key << 40 | (uint64_t)port << 32 | time;
+
+    std::atomic<uint64_t> &slot = dedupWindow[(key * 2654435761u) >> 24 & (dedupSlots - 1)];
+    uint64_t previous = slot.load(std::memory_order_relaxed);
+    do
+    {
+        bool sameEvent = (previous >> 40) == key && (previous >> 32 & 0xFF) != (uint32_t)port;
+        uint32_t age = time - (uint32_t)previous;
+        if (previous != 0 && sameEvent && age * dedupTimeUnitNs <= (uint64_t)dedupWindowNs)
+        {
+            duplicateCount.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        // Retry if another port's callback updated the slot in the meantime
+    } while (!slot.compare_exchange_weak(previous, entry, std::memory_order_relaxed));
+    return false;
+}
+
+void printFilterStats()
+{
+    std::cout << "Filtered midi messages:" << std::endl;
+    for (int i = 0; i < numMessageTypes; i++)
+    {
+        std::cout << "    " << messageTypeNames[i] << ": "
+                  << filteredCounts[i].load(std::memory_order_relaxed) << std::endl;
+    }
+    std::cout << "    duplicates: " << duplicateCount.load(std::memory_order_relaxed) << std::endl;
+    std::cout << "    dropped (queue full): " << queueFullCount.load(std::memory_order_relaxed)
+              << std::endl;
+}
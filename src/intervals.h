@@ -0,0 +1,143 @@
+/**
+ *  Interval content of the music over a sliding time window
+ *
+ *  Keeps a histogram of the interval classes which have sounded in the last few seconds. An
+ *  interval class is the interval between two notes reduced to within half a period, so a
+ *  fifth and a fourth fall in the same class. The histogram is binned in the same units used
+ *  to colour the edges, so each bar can be drawn in the colour of the edges it counts.
+ *
+ *  The counts are kept up to date incrementally rather than recomputed:
+ *      note-on     each interval it forms with the sounding notes is counted
+ *      note-off    each interval it formed is queued to be uncounted once the window has passed
+ *      each frame  intervals whose time is up are popped from the front of the queue
+ *  So the work per note is proportional to the number of sounding notes, and the work per
+ *  frame to the number of intervals expiring, however long the window is.
+ *
+ *  Times are latency compensated (see merge.h). Note-offs can still come a little out of time
+ *  order, from a device whose latency wanders or a jitter buffer which filled up, so an expiry
+ *  time is never queued before the one ahead of it. The queue stays in time order, and a late
+ *  stamped interval holds the ones behind it back only by as long as it was late.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "voices.h"
+
+class IntervalHistogram : public VoiceListener
+{
+  public:
+    // Bins are centred on multiples of 1/120 of a period (10 cents for octave tunings), so
+    // equal tempered intervals sit in the middle of a bin rather than on a boundary
+    static constexpr int numBins = 61;
+
+    // Capacity of the expiry queue; if it fills up the oldest intervals are expired early
+    static constexpr int queueCapacity = 1 << 16;
+
+    explicit IntervalHistogram(double windowSeconds)
+        : windowNs(windowSeconds * 1e9), expiry(queueCapacity)
+    {
+        counts.fill(0);
+    }
+
+    // Bin of the interval between two angles on the pitch circle
+    static int bin(double angle1, double angle2)
+    {
+        // Same folding as lineGeometryShaderSource: 0 for unison, 1 for half a period
+        double x = std::fmod(std::abs(angle2 - angle1) / (TWOPI / 2), 2.0);
+        double color = x < 1.0 ? x : 2.0 - x;
+        return (int)std::lround(color * (numBins - 1));
+    }
+
+    void voiceOn(int slot, const Voice &voice, int64_t time) override
+    {
+        for (int i = 0; i < numSounding; i++)
+        {
+            counts[bin(voice.angle, angles[i])]++;
+        }
+        slots[numSounding] = slot;
+        angles[numSounding] = voice.angle;
+        numSounding++;
+        changed = true;
+    }
+
+    void voiceOff(int slot, const Voice &voice, int64_t time) override
+    {
+        int i = std::find(slots.begin(), slots.begin() + numSounding, slot) - slots.begin();
+        numSounding--;
+        slots[i] = slots[numSounding];
+        angles[i] = angles[numSounding];
+        for (int j = 0; j < numSounding; j++)
+        {
+            if (size == queueCapacity)
+            {
+                expireOldest();
+            }
+            lastQueued = std::max(lastQueued, time + windowNs);
+            expiry[(head + size) % queueCapacity] =
+                Expiry{lastQueued, bin(voice.angle, angles[j])};
+            size++;
+        }
+    }
+
+    // Uncount intervals which stopped sounding more than the window length before now, on the
+    // latency compensated clock
+    void expire(int64_t now)
+    {
+        while (size > 0 && expiry[head].time <= now)
+        {
+            expireOldest();
+        }
+    }
+
+    // Bar heights scaled so the largest is 1; returns false if unchanged since the last call
+    bool heights(float out[numBins])
+    {
+        if (!changed)
+        {
+            return false;
+        }
+        changed = false;
+        int largest = std::max(1, *std::max_element(counts.begin(), counts.end()));
+        for (int i = 0; i < numBins; i++)
+        {
+            out[i] = (float)counts[i] / largest;
+        }
+        return true;
+    }
+
+  private:
+    struct Expiry
+    {
+        int64_t time;
+        int bin;
+    };
+
+    void expireOldest()
+    {
+        counts[expiry[head].bin]--;
+        head = (head + 1) % queueCapacity;
+        size--;
+        changed = true;
+    }
+
+    int64_t windowNs;
+    std::array<int, numBins> counts;
+    bool changed = true;
+
+    // Sounding notes, unordered
+    std::array<int, maxNotes> slots;
+    std::array<double, maxNotes> angles;
+    int numSounding = 0;
+
+    // Ring buffer of intervals waiting to expire, in time order
+    std::vector<Expiry> expiry;
+    int head = 0;
+    int size = 0;
+    int64_t lastQueued = INT64_MIN; // expiry time queued last
+};
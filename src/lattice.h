@@ -0,0 +1,219 @@
+/**
+ *  Just intonation lattice view
+ *
+ *  Places each sounding note at the just ratio nearest to its pitch, relative to a reference
+ *  note, on a lattice with one axis per prime: 3 across, 5 up and to the right, 7 up and to the
+ *  left. Octaves are ignored, so each point stands for a pitch class. Notes a single prime step
+ *  apart (a fifth, a major third or a harmonic seventh, up to octaves) are joined by an edge.
+ *
+ *  Finding the nearest ratio means searching a few hundred candidates, so it is done for every
+ *  (channel, note) once per tuning change and stored. When a note starts, its lattice position
+ *  is a lookup, and the nodes and edges are only recomputed when the sounding notes change.
+ */
+
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "tuning.h"
+#include "voices.h"
+
+// A 7-limit just ratio, as a product of prime powers
+struct JustRatio
+{
+    int e2 = 0, e3 = 0, e5 = 0, e7 = 0;
+    float errorCents = 0.0f; // distance from the pitch it was chosen for
+
+    double cents() const
+    {
+        return 1200.0 * (e2 + e3 * std::log2(3.0) + e5 * std::log2(5.0) + e7 * std::log2(7.0));
+    }
+
+    // Write the ratio as numerator/denominator into out, which holds size characters
+    void format(char *out, size_t size) const
+    {
+        long long num = 1, den = 1;
+        auto multiply = [&](int base, int exponent) {
+            for (int i = 0; i < std::abs(exponent); i++)
+                (exponent > 0 ? num : den) *= base;
+        };
+        multiply(2, e2);
+        multiply(3, e3);
+        multiply(5, e5);
+        multiply(7, e7);
+        std::snprintf(out, size, "%lld/%lld", num, den);
+    }
+};
+
+/**
+ * The just ratio nearest an interval in cents
+ *
+ * Candidates have exponents of 3, 5 and 7 up to 4, 2 and 1 in size. Each is scored by its
+ * error in cents plus twice the log of its Tenney height, favouring simple ratios over complex
+ * ones which happen to be slightly closer (so 400 cents is a 5/4, not a 63/50).
+ */
+JustRatio nearestJustRatio(double cents)
+{
+    struct Candidate
+    {
+        JustRatio ratio;
+        double cents;      // reduced into [0, 1200)
+        double complexity; // log2 of numerator times denominator
+    };
+    // Held in place, so the first search, whenever it comes, doesn't touch the heap
+    static std::array<Candidate, 9 * 5 * 3> candidates = [] {
+        std::array<Candidate, 9 * 5 * 3> c;
+        int n = 0;
+        for (int e3 = -4; e3 <= 4; e3++)
+            for (int e5 = -2; e5 <= 2; e5++)
+                for (int e7 = -1; e7 <= 1; e7++)
+                {
+                    JustRatio r{0, e3, e5, e7};
+                    r.e2 = -(int)std::floor(r.cents() / 1200.0);
+                    double complexity = std::abs(r.e2) + std::abs(e3) * std::log2(3.0) +
+                                        std::abs(e5) * std::log2(5.0) +
+                                        std::abs(e7) * std::log2(7.0);
+                    c[n++] = Candidate{r, r.cents(), complexity};
+                }
+        return c;
+    }();
+
+    double octaves = std::floor(cents / 1200.0);
+    double reduced = cents - 1200.0 * octaves;
+    const Candidate *best = nullptr;
+    double bestScore = 0.0;
+    double bestError = 0.0;
+    for (const Candidate &c : candidates)
+    {
+        // Compare round the octave, so 1190 cents is close to 1/1
+        double error = reduced - c.cents;
+        error -= 1200.0 * std::round(error / 1200.0);
+        double score = std::abs(error) + 2.0 * c.complexity;
+        if (best == nullptr || score < bestScore)
+        {
+            best = &c;
+            bestScore = score;
+            bestError = error;
+        }
+    }
+    JustRatio ratio = best->ratio;
+    ratio.e2 += (int)std::round((cents - bestError - ratio.cents()) / 1200.0);
+    ratio.errorCents = bestError;
+    return ratio;
+}
+
+// Position of a note on the lattice
+struct LatticePoint
+{
+    JustRatio ratio;
+    float x = 0.0f, y = 0.0f;
+};
+
+class LatticeView : public VoiceListener
+{
+  public:
+    // Lattice coordinates are scaled by this to fit the panel
+    static constexpr float scale = 1.0f / 5.5f;
+
+    LatticeView(TuningTable &tuning, int referenceNote) : tuning(tuning), reference(referenceNote)
+    {
+        // Room for every note and every pair, so playing never grows them
+        nodes.reserve(2 * maxNotes);
+        edges.reserve(4 * maxEdges);
+    }
+
+    // Lattice position of a note under the current tuning
+    const LatticePoint &point(int channel, int note)
+    {
+        if (builtGeneration != tuning.generation)
+        {
+            rebuild();
+        }
+        return points[channel][note];
+    }
+
+    void voiceOn(int slot, const Voice &voice, int64_t time) override
+    {
+        sounding[slot] = &point(voice.channel, voice.note);
+        update();
+    }
+
+    void voiceOff(int slot, const Voice &voice, int64_t time) override
+    {
+        sounding[slot] = nullptr;
+        update();
+    }
+
+    // Node centres, as x, y pairs in [-1, 1]
+    std::vector<float> nodes;
+
+    // Edges, as x1, y1, x2, y2 in [-1, 1]
+    std::vector<float> edges;
+
+    // Set whenever nodes or edges change; cleared by whoever uploads them
+    bool changed = true;
+
+  private:
+    void rebuild()
+    {
+        double referenceFreq = tuning.cached(0, reference);
+        for (int channel = 0; channel < 16; channel++)
+        {
+            for (int note = 0; note < 128; note++)
+            {
+                // Channels without their own tuning match channel 0, so can share its work
+                if (channel > 0 && tuning.cached(channel, note) == tuning.cached(0, note))
+                {
+                    points[channel][note] = points[0][note];
+                    continue;
+                }
+                LatticePoint &p = points[channel][note];
+                p.ratio = nearestJustRatio(1200.0 * std::log2(tuning.cached(channel, note) /
+                                                              referenceFreq));
+                p.x = scale * (p.ratio.e3 + 0.5f * p.ratio.e5 - 0.35f * p.ratio.e7);
+                p.y = scale * (0.85f * p.ratio.e5 + 0.55f * p.ratio.e7);
+            }
+        }
+        builtGeneration = tuning.generation;
+    }
+
+    // Recompute the nodes, and edges between notes one prime step apart
+    void update()
+    {
+        nodes.clear();
+        edges.clear();
+        for (int i = 0; i < maxNotes; i++)
+        {
+            const LatticePoint *a = sounding[i];
+            if (a == nullptr)
+                continue;
+            nodes.push_back(a->x);
+            nodes.push_back(a->y);
+            for (int j = i + 1; j < maxNotes; j++)
+            {
+                const LatticePoint *b = sounding[j];
+                if (b == nullptr)
+                    continue;
+                int steps = std::abs(a->ratio.e3 - b->ratio.e3) +
+                            std::abs(a->ratio.e5 - b->ratio.e5) +
+                            std::abs(a->ratio.e7 - b->ratio.e7);
+                if (steps == 1)
+                {
+                    edges.insert(edges.end(), {a->x, a->y, b->x, b->y});
+                }
+            }
+        }
+        changed = true;
+    }
+
+    TuningTable &tuning;
+    int reference;
+    uint64_t builtGeneration = 0;
+    LatticePoint points[16][128];
+    std::array<const LatticePoint *, maxNotes> sounding{};
+};
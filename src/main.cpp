@@ -9,14 +9,18 @@
  *      Each line is coloured based on the size of the corresponding interval
  *  Draws the pitch circle itself
  *      Slowly rotating
+ *  Pitch bends glide smoothly, interpolated in the shaders at the time each frame is shown
+ *  The view can zoom in on an arc of the circle, to tell apart notes a fraction of a cent apart
  *
- *  Uses OpenGL. See shaders.h for the shader source code.
+ *  Uses OpenGL, or OpenGL ES 3.0. See shaders.h for the shader source code.
  */
 
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <optional>
 #include <thread>
-#include <map>
-#include <ranges>
 #include <cmath>
 
 #include <glad/glad.h>
@@ -25,6 +29,31 @@
 #include <readerwriterqueue.h>
 #include <libMTSClient.h>
 
+#include "arena.h"
+#include "camera.h"
+#include "clock.h"
+#include "clusters.h"
+#include "commands.h"
+#include "debug.h"
+#include "display.h"
+#include "framesink.h"
+#include "glide.h"
+#include "ingest.h"
+#include "intervals.h"
+#include "lattice.h"
+#include "mapping.h"
+#include "metrics.h"
+#include "merge.h"
+#include "network.h"
+#include "options.h"
+#include "pacing.h"
+#include "picking.h"
+#include "recorder.h"
+#include "renderer.h"
+#include "tiles.h"
+#include "tuning.h"
+#include "voices.h"
+
 #ifdef TEXTURE_FROM_FILE
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -32,18 +61,73 @@
 
 #define TWOPI 6.283185307179586
 
-// Queue used to receive midi messages
-static moodycamel::ReaderWriterQueue<libremidi::message, 4096> midiMessageQueue(128);
+#ifndef NDEBUG
+// Heap allocations made by each thread, counted so the main loop can check it makes none
+static thread_local uint64_t heapAllocations = 0;
+
+// Frames of the main loop which allocated once it had warmed up
+static uint64_t allocatingFrames = 0;
+
+void *operator new(std::size_t size)
+{
+    heapAllocations++;
+    void *p = std::malloc(size == 0 ? 1 : size);
+    if (p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, std::size_t size) noexcept { std::free(p); }
+#endif
+
+// Note sharing with other instances, which delivers messages as an extra port
+static Network network;
+static int networkPort = -1;
+
+// Recording of the session to a file, if asked for
+static SessionRecorder *recorder = nullptr;
+
+// Frames sent to other programs through shared memory, if asked for
+static FrameSink *frameSink = nullptr;
+
+// Frame rate cap, if asked for
+static FramePacer *pacer = nullptr;
+
+// How buffers are updated, picked once the GL context exists
+static Renderer *renderer = nullptr;
+
+// Tiles of a video wall, or just the one covering the window
+static TileLayout tiles;
+
+// Consonance of each edge, if edges are weighted by it
+static EdgeMetrics *edgeMetrics = nullptr;
+
+// Near-coincident notes drawn as one, if asked for
+static NoteClusters *clusters = nullptr;
+
+// GL state set by draws, so state already set is skipped
+static StateCache stateCache;
+
+// Memory for data that only lasts a frame
+static FrameArena frameArena(64 * 1024);
 
-// Scale factors to adjust for window aspect ratio
+// Scale factors to adjust for the canvas aspect ratio
 static float scaleX = 1.0;
 static float scaleY = 1.0;
 
 // Number of points to use when drawing the pitch circle
 static constexpr int N = 1024;
 
-// Maximum number of simultaneously displayable notes
-static constexpr int maxNotes = 16;
+// View onto the pitch circle, and scrolling towards zooming it not yet applied
+static Camera camera;
+static double scrollAmount = 0.0;
+
+// Smoothed time between frames, for working out when the frame being drawn will be shown
+static int64_t framePeriodNs = 16666667;
 
 // clang-format off
 // Indices of all edges between maxNotes vertices
@@ -174,28 +258,240 @@ static unsigned int indices[] = {
 // Set scale factors when window is resized
 void framebuffer_size_callback(GLFWwindow *window, int width, int height)
 {
-    float aspect = (float)height / (float)width;
+    tiles.resize(width, height);
+    float aspect = tiles.canvasHeight() / tiles.canvasWidth();
     scaleX = aspect <= 1.0 ? aspect : 1.0;
     scaleY = aspect <= 1.0 ? 1.0 : 1.0 / aspect;
-    glViewport(0, 0, width, height);
 }
 
-// Close window if escape key is pressed
-void processInput(GLFWwindow *window)
+// Collect scrolling, which processInput turns into zooming
+void scroll_callback(GLFWwindow *window, double xoffset, double yoffset)
+{
+    scrollAmount += yoffset;
+}
+
+// Print counters useful for diagnosing dropped or missing notes
+void printDiagnostics()
+{
+    printFilterStats();
+    printMergeStats();
+    if (networkPort >= 0)
+        network.printStats();
+    if (recorder != nullptr)
+        recorder->printStats();
+    if (frameSink != nullptr)
+        frameSink->printStats();
+    if (pacer != nullptr)
+        pacer->printStats();
+    if (edgeMetrics != nullptr)
+        edgeMetrics->printStats();
+    if (renderer != nullptr)
+    {
+        stateCache.printStats();
+        frameArena.printStats();
+#ifndef NDEBUG
+        std::cout << "    frames which allocated from the heap: " << allocatingFrames << std::endl;
+#endif
+    }
+    std::cout << "Frame rate: " << 1e9 / framePeriodNs << " Hz" << std::endl;
+}
+
+// Whether key has been pressed since the last call, for keys which toggle things
+bool keyPressed(GLFWwindow *window, int key)
+{
+    static bool keyDown[GLFW_KEY_LAST + 1] = {false};
+    bool down = glfwGetKey(window, key) == GLFW_PRESS;
+    bool pressed = down && !keyDown[key];
+    keyDown[key] = down;
+    return pressed;
+}
+
+/**
+ * Handle keyboard input
+ *
+ *      Escape  close window
+ *      D       print diagnostics
+ *      L       start or finish latency calibration
+ *      M       switch between period and generator layouts
+ *      Scroll  zoom in or out on the arc under the mouse
+ *      Left    turn the view anticlockwise
+ *      Right   turn the view clockwise
+ *      Home    reset the view to the whole circle
+ */
+void processInput(GLFWwindow *window, AngleTable &angles)
 {
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
+
+    if (keyPressed(window, GLFW_KEY_D))
+        printDiagnostics();
+
+    if (keyPressed(window, GLFW_KEY_L))
+    {
+        if (latencyCalibration.active)
+            latencyCalibration.finish();
+        else
+            latencyCalibration.start();
+    }
+
+    if (keyPressed(window, GLFW_KEY_M))
+    {
+        Mapping mapping = angles.getMapping();
+        mapping.layout = mapping.layout == Mapping::Period ? Mapping::Generator : Mapping::Period;
+        angles.setMapping(mapping);
+    }
+
+    if (scrollAmount != 0.0)
+    {
+        double cursorX, cursorY;
+        int width, height;
+        double x, y;
+        glfwGetCursorPos(window, &cursorX, &cursorY);
+        glfwGetWindowSize(window, &width, &height);
+        tiles.windowToCanvas(cursorX / width, cursorY / height, x, y);
+        camera.zoomAt(std::pow(1.2, scrollAmount), x / scaleX);
+        scrollAmount = 0.0;
+    }
+    if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
+        camera.pan(-0.02);
+    if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
+        camera.pan(0.02);
+    if (keyPressed(window, GLFW_KEY_HOME))
+        camera.reset();
+}
+
+// Write text describing a picked note or edge into text, which holds size characters, or
+// nothing if nothing is picked; written in place, as hovering changes it from frame to frame
+void describePick(const Pick &pick, const Voices &voices, const PitchGlides &glides, char *text,
+                  size_t size)
+{
+    text[0] = '\0';
+    if (pick.kind == Pick::Note)
+    {
+        const Voice &v = voices[pick.slot1];
+        int n = 0;
+        if (v.source > 0)
+            n = std::snprintf(text, size, "peer %d ", (int)v.source);
+        std::snprintf(text + n, size - n, "channel %d note %d: %.2f Hz", v.channel + 1,
+                      (int)v.note, glides.frequency(v));
+    }
+    if (pick.kind == Pick::Edge)
+    {
+        double cents = std::abs(1200.0 * std::log2(glides.frequency(voices[pick.slot2]) /
+                                                   glides.frequency(voices[pick.slot1])));
+        JustRatio ratio = nearestJustRatio(cents);
+        char name[32];
+        ratio.format(name, sizeof(name));
+        std::snprintf(text, size, "%.1f cents, nearest %s (%+.1f cents)", cents, name,
+                      ratio.errorCents);
+    }
 }
 
-GLFWwindow *setupWindow()
+/**
+ * Find what is under the mouse
+ *
+ * Hovering shows the picked note's frequency, or the picked edge's interval, in the window
+ * title. Clicking prints it.
+ */
+void processPicking(GLFWwindow *window, PickIndex &index, const Voices &voices,
+                    const PitchGlides &glides, Pick &hover)
 {
+    index.sync(voices, glides);
+
+    double cursorX, cursorY;
+    int width, height;
+    glfwGetCursorPos(window, &cursorX, &cursorY);
+    glfwGetWindowSize(window, &width, &height);
+    if (width == 0 || height == 0)
+    {
+        return;
+    }
+    double x, y;
+    tiles.windowToCanvas(cursorX / width, cursorY / height, x, y);
+    camera.unproject(x / scaleX, y / scaleY, x, y);
+
+    Pick pick = index.pick(x, y, camera.zoom);
+    char text[128];
+    if (!(pick == hover))
+    {
+        hover = pick;
+        describePick(pick, voices, glides, text, sizeof(text));
+        char title[160] = "Chordagon";
+        if (text[0] != '\0')
+            std::snprintf(title, sizeof(title), "Chordagon - %s", text);
+        glfwSetWindowTitle(window, title);
+    }
+
+    static bool buttonDown = false;
+    bool down = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+    if (down && !buttonDown && pick.kind != Pick::None)
+    {
+        describePick(pick, voices, glides, text, sizeof(text));
+        std::cout << text << std::endl;
+    }
+    buttonDown = down;
+}
+
+/**
+ * Create the window and its GL context
+ *
+ * Asks for a desktop 4.5 context unless the 3.3 renderer is forced, falling back to 3.3 where
+ * 4.5 isn't available, then to GLES 3.0 where there is no desktop GL. Forcing the GLES renderer
+ * asks for GLES straight away. Which renderer is used is decided from the context actually
+ * created.
+ *
+ * Multisampling defaults to 4 samples on desktop GL, but is off for GLES unless asked for, as
+ * resolving it costs tile-based GPUs a pass over the framebuffer.
+ *
+ * Fullscreen, the window covers the chosen monitor in its current video mode (see display.h).
+ */
+GLFWwindow *setupWindow(const Options &options)
+{
+    Renderer::Tier tier = options.renderer;
+    int samples = options.samples;
+
     glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_SAMPLES, 4);
 
-    GLFWwindow *window = glfwCreateWindow(600, 600, "Chordagon", NULL, NULL);
+    GLFWmonitor *monitor = NULL;
+    int windowWidth = 600, windowHeight = 600;
+    if (options.fullscreen)
+    {
+        monitor = chooseMonitor(options.monitor);
+        matchVideoMode(monitor);
+        windowWidth = glfwGetVideoMode(monitor)->width;
+        windowHeight = glfwGetVideoMode(monitor)->height;
+    }
+
+    // Nothing is depth or stencil tested, so don't allocate either buffer
+    glfwWindowHint(GLFW_DEPTH_BITS, 0);
+    glfwWindowHint(GLFW_STENCIL_BITS, 0);
+    requestDebugContext();
+
+    GLFWwindow *window = NULL;
+    auto create = [&](int major, int minor) {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, major);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, minor);
+        window = glfwCreateWindow(windowWidth, windowHeight, "Chordagon", monitor, NULL);
+    };
+
+    bool es = tier == Renderer::GLES30;
+    if (!es)
+    {
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_SAMPLES, samples < 0 ? 4 : samples);
+        if (tier != Renderer::GL33)
+            create(4, 5);
+        if (window == NULL)
+            create(3, 3);
+    }
+    if (window == NULL && (es || tier == Renderer::Auto))
+    {
+        es = true;
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_ES_API);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_ANY_PROFILE);
+        glfwWindowHint(GLFW_SAMPLES, samples < 0 ? 0 : samples);
+        create(3, 0);
+    }
     if (window == NULL)
     {
         std::cout << "Failed to create GLFW window" << std::endl;
@@ -203,25 +499,37 @@ GLFWwindow *setupWindow()
         exit(-1);
     }
     glfwMakeContextCurrent(window);
+    reportDisplay(window, applySwapMode(options.swap));
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    framebuffer_size_callback(window, width, height);
+    glfwSetScrollCallback(window, scroll_callback);
 
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
     {
         std::cout << "Failed to initialize GLAD" << std::endl;
         exit(-1);
     }
+    setupDebugOutput();
+
+    // GLES multisamples whenever the framebuffer has samples, and has no switch for it
+    if (!es)
+        glEnable(GL_MULTISAMPLE);
 
-    glEnable(GL_MULTISAMPLE);
+    renderer = createRenderer(tier);
 
     return window;
 }
 
+// Buffers holding lattice node and edge positions
+static unsigned int latticeVBO[2];
+
 // Set up all vertices needed
 void setupVertices(unsigned int VAO[])
 {
-    unsigned int VBO, EBO;
-    glGenVertexArrays(3, VAO);
-    glGenBuffers(1, &VBO);
+    unsigned int EBO;
+    glGenVertexArrays(6, VAO);
     glGenBuffers(1, &EBO);
 
     // Set up vertex array object for edges
@@ -231,33 +539,38 @@ void setupVertices(unsigned int VAO[])
     glBindVertexArray(0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-    // Set up vertex array object for points
-    glBindVertexArray(VAO[1]);
-    glBindVertexArray(0);
+    // Vertex array objects for points and the circle are left empty, the shaders place them
+
+    // Vertex array object for the interval bars is left empty, the shader places the bars
 
-    // Set up vertex array object for circle
-    constexpr int M = 3 * (N + 1);
-    float circleVertices[2 * M] = {0.0f};
-    float theta = 0.0f;
-    for (int i = 0; i <= N; i++)
-    {
-        theta = i * TWOPI / N;
-        float c = std::cos(theta);
-        float s = std::sin(theta);
-        float d = std::abs(0.01 * sin(60 * theta));
-        circleVertices[3 * (2 * i)] = (0.8 + d) * c;
-        circleVertices[3 * (2 * i) + 1] = (0.8 + d) * s;
-        circleVertices[3 * (2 * i + 1)] = (0.8 - d) * c;
-        circleVertices[3 * (2 * i + 1) + 1] = (0.8 - d) * s;
-    }
-
-    glBindVertexArray(VAO[2]);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(circleVertices), circleVertices, GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
-    glEnableVertexAttribArray(0);
+    // Set up vertex array objects for lattice nodes and edges, one instance per node or edge
+    glGenBuffers(2, latticeVBO);
+    for (int i = 0; i < 2; i++)
+    {
+        glBindVertexArray(VAO[4 + i]);
+        glBindBuffer(GL_ARRAY_BUFFER, latticeVBO[i]);
+        int size = i == 0 ? 2 : 4;
+        glVertexAttribPointer(0, size, GL_FLOAT, GL_FALSE, size * sizeof(float), (void *)0);
+        glVertexAttribDivisor(0, 1);
+        glEnableVertexAttribArray(0);
+    }
     glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Vertex arrays only exist once bound, so bind the empty ones before naming them all
+    const char *names[6] = {"Edges", "Notes", "Circle", "Interval bars", "Lattice nodes",
+                            "Lattice edges"};
+    for (int i = 0; i < 6; i++)
+    {
+        glBindVertexArray(VAO[i]);
+        labelObject(GL_VERTEX_ARRAY, VAO[i], names[i]);
+    }
     glBindVertexArray(0);
+    labelObject(GL_BUFFER, EBO, "Edge indices");
+    labelObject(GL_BUFFER, latticeVBO[0], "Lattice nodes");
+    labelObject(GL_BUFFER, latticeVBO[1], "Lattice edges");
+
+    // Vertex arrays were bound here rather than through the state cache
+    stateCache.invalidate();
 }
 
 // Load texture for edge colors
@@ -277,6 +590,8 @@ unsigned int loadTexture()
     glBindTexture(GL_TEXTURE_2D, texture);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
     glGenerateMipmap(GL_TEXTURE_2D);
+    labelObject(GL_TEXTURE, texture, "Rainbow");
+    stateCache.invalidate();
 
 #ifdef TEXTURE_FROM_FILE
     // Print header corresponding to loaded image to stdout
@@ -297,28 +612,83 @@ unsigned int loadTexture()
     return texture;
 }
 
-void setupMIDI()
+void setupMIDI(const Options &options)
 {
-    // Each midi input puts its messages onto the midiMessageQueue
-    auto my_callback = [](const libremidi::message &message) {
-        midiMessageQueue.try_enqueue(message);
-    };
-
     libremidi::observer obs;
 
+    dedupPorts = options.dedupPorts;
+    dedupWindowNs = options.dedupWindowMs * 1e6;
+    for (const auto &[port, latencyMs] : options.portLatenciesMs)
+    {
+        setPortLatency(port, latencyMs * 1e6);
+    }
+
+    // Following MIDI clock needs clock and transport messages
+    uint32_t acceptMask = options.acceptMask;
+    if (options.clockSync)
+    {
+        acceptMask |= MessageClock | MessageTransport;
+    }
+
     // Listen on all midi ports
     int i = 0;
     std::cout << "MIDI input ports:" << std::endl;
     for (const libremidi::input_port &port : obs.get_input_ports())
     {
-        std::cout << i++ << ": " << port.port_name << std::endl;
-        libremidi::midi_in *midi =
-            new libremidi::midi_in{libremidi::input_configuration{.on_message = my_callback}};
+        if (i == maxPorts)
+        {
+            std::cout << "Ignoring ports beyond " << maxPorts << std::endl;
+            break;
+        }
+        std::cout << i << ": " << port.port_name << std::endl;
+
+        auto mask = options.portAcceptMasks.find(i);
+        portAcceptMasks[i] =
+            mask != options.portAcceptMasks.end() ? mask->second : acceptMask;
+
+        // Each midi input timestamps the messages it accepts and puts them on its own queue
+        MessageQueue *queue = portQueues[i] = new MessageQueue(128);
+        numPorts = i + 1;
+        auto my_callback = [i, queue](const libremidi::message &message) {
+            int64_t now = ingestClock();
+            if (!acceptMessage(i, message) || isDuplicate(i, message, now))
+            {
+                return;
+            }
+            if (!queue->try_enqueue(SourcedMessage{libremidi::message{message.bytes, now}, 0}))
+            {
+                queueFullCount.fetch_add(1, std::memory_order_relaxed);
+            }
+        };
+        libremidi::input_configuration config{.on_message = my_callback};
+        applyIgnoreOptions(config, portAcceptMasks[i]);
+        libremidi::midi_in *midi = new libremidi::midi_in{config};
         midi->open_port(port);
+        i++;
     }
     std::cout << std::endl;
 }
 
+// Start sharing notes over multicast if asked to
+void setupNetwork(const Options &options)
+{
+    if (!options.share)
+    {
+        return;
+    }
+    if (numPorts == maxPorts)
+    {
+        std::cout << "ERROR::NETWORK::NO_FREE_PORT" << std::endl;
+        return;
+    }
+    portQueues[numPorts] = new MessageQueue(128);
+    if (network.start(options.shareGroup, options.sharePort, portQueues[numPorts]))
+    {
+        networkPort = numPorts++;
+        std::cout << "Shared notes arrive on port " << networkPort << std::endl << std::endl;
+    }
+}
+
 /**
  * Compile a shader program from source text
  *
@@ -400,137 +770,637 @@ unsigned int compileShaderProgram(std::string vertexCode, std::string fragmentCo
     return compileShaderProgram(vertexCode, "", fragmentCode);
 }
 
+// Compile a compute shader program
+unsigned int compileComputeProgram(std::string computeCode)
+{
+    const char *cShaderCode = computeCode.c_str();
+    int success;
+    char infoLog[512];
+
+    unsigned int compute = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(compute, 1, &cShaderCode, NULL);
+    glCompileShader(compute);
+    glGetShaderiv(compute, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderInfoLog(compute, 512, NULL, infoLog);
+        std::cout << "ERROR::SHADER::COMPUTE::COMPILATION_FAILED\n" << infoLog << std::endl;
+    }
+    unsigned int ID = glCreateProgram();
+    glAttachShader(ID, compute);
+    glLinkProgram(ID);
+    glGetProgramiv(ID, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glGetProgramInfoLog(ID, 512, NULL, infoLog);
+        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+    }
+    glDeleteShader(compute);
+
+    return ID;
+}
+
 // IDs of all shader programs used later on
 struct ShaderPrograms
 {
     unsigned int point;
     unsigned int line;
     unsigned int circle;
+    unsigned int bars;
+    unsigned int latticeNode;
+    unsigned int latticeEdge;
+    unsigned int edgeMetrics; // compute program, or 0 without compute shaders
+
+    // Locations of the uniforms draws set
+    int barHeights;
+    int latticeNodePanel;
+    int latticeEdgePanel;
+    int multiplicity;
 };
 
-// Compile all shader programs
-ShaderPrograms compileShaders()
+/**
+ * Compile all shader programs
+ *
+ * The same sources are used for desktop GL and GLES, behind the prelude for each. GLES has no
+ * geometry shaders, so there notes and edges use the instanced vertex shaders instead. The
+ * edge metrics compute shader is only compiled when compute is true. The locations of the
+ * uniforms draws set are looked up here, once.
+ */
+ShaderPrograms compileShaders(const Renderer &renderer, bool compute)
 {
     // Include shader source code strings
 #include "shaders.h"
 
-    unsigned int pointShaderProgram = compileShaderProgram(
-        pointVertexShaderSource, pointGeometryShaderSource, pointFragmentShaderSource);
-    unsigned int lineShaderProgram = compileShaderProgram(
-        pointVertexShaderSource, lineGeometryShaderSource, lineFragmentShaderSource);
+    std::string p = renderer.es() ? esPrelude : desktopPrelude;
+
+    unsigned int pointShaderProgram, lineShaderProgram;
+    if (renderer.es())
+    {
+        pointShaderProgram = compileShaderProgram(p + pointInstancedVertexShaderSource,
+                                                  p + pointFragmentShaderSource);
+        lineShaderProgram = compileShaderProgram(p + lineInstancedVertexShaderSource,
+                                                 p + lineFragmentShaderSource);
+    }
+    else
+    {
+        pointShaderProgram = compileShaderProgram(p + pointVertexShaderSource,
+                                                  p + pointGeometryShaderSource,
+                                                  p + pointFragmentShaderSource);
+        lineShaderProgram = compileShaderProgram(p + pointVertexShaderSource,
+                                                 p + lineGeometryShaderSource,
+                                                 p + lineFragmentShaderSource);
+    }
     unsigned int circleShaderProgram =
-        compileShaderProgram(circleVertexShaderSource, circleFragmentShaderSource);
-    return ShaderPrograms{pointShaderProgram, lineShaderProgram, circleShaderProgram};
+        compileShaderProgram(p + circleVertexShaderSource, p + circleFragmentShaderSource);
+    unsigned int barShaderProgram =
+        compileShaderProgram(p + barVertexShaderSource, p + lineFragmentShaderSource);
+    unsigned int latticeNodeShaderProgram = compileShaderProgram(
+        p + latticeNodeVertexShaderSource, p + latticeNodeFragmentShaderSource);
+    unsigned int latticeEdgeShaderProgram =
+        compileShaderProgram(p + latticeEdgeVertexShaderSource, p + circleFragmentShaderSource);
+    labelObject(GL_PROGRAM, pointShaderProgram, "Point");
+    labelObject(GL_PROGRAM, lineShaderProgram, "Line");
+    labelObject(GL_PROGRAM, circleShaderProgram, "Circle");
+    labelObject(GL_PROGRAM, barShaderProgram, "Bars");
+    labelObject(GL_PROGRAM, latticeNodeShaderProgram, "Lattice node");
+    labelObject(GL_PROGRAM, latticeEdgeShaderProgram, "Lattice edge");
+    unsigned int edgeMetricsProgram = 0;
+    if (compute)
+    {
+        edgeMetricsProgram = compileComputeProgram(computePrelude + edgeMetricsComputeShaderSource);
+        labelObject(GL_PROGRAM, edgeMetricsProgram, "Edge metrics");
+    }
+    return ShaderPrograms{pointShaderProgram,
+                          lineShaderProgram,
+                          circleShaderProgram,
+                          barShaderProgram,
+                          latticeNodeShaderProgram,
+                          latticeEdgeShaderProgram,
+                          edgeMetricsProgram,
+                          glGetUniformLocation(barShaderProgram, "heights"),
+                          glGetUniformLocation(latticeNodeShaderProgram, "panel"),
+                          glGetUniformLocation(latticeEdgeShaderProgram, "panel"),
+                          glGetUniformLocation(pointShaderProgram, "multiplicity")};
 }
 
-// Update the noteAngles map based on midi messages received
-void updateNoteAngles(MTSClient *c, std::map<char, float> &noteAngles)
+// Point the programs' uniform blocks at the bindings the renderer fills in
+void bindUniformBlocks(ShaderPrograms shaders)
 {
-    libremidi::message m;
-    double freq = 0.0;
-    char noteNumber = 0;
-    char velocity = 0;
+    for (unsigned int program : {shaders.point, shaders.line, shaders.circle, shaders.bars,
+                                 shaders.latticeNode, shaders.latticeEdge})
+    {
+        unsigned int frame = glGetUniformBlockIndex(program, "Frame");
+        unsigned int keyframes = glGetUniformBlockIndex(program, "Keyframes");
+        unsigned int metrics = glGetUniformBlockIndex(program, "EdgeMetrics");
+        glUniformBlockBinding(program, frame, frameBinding);
+        if (keyframes != GL_INVALID_INDEX)
+        {
+            glUniformBlockBinding(program, keyframes, keyframesBinding);
+        }
+        if (metrics != GL_INVALID_INDEX)
+        {
+            glUniformBlockBinding(program, metrics, edgeMetricsBinding);
+        }
+    }
+}
+
+// Handle a midi message from a source, updating the voices, at its latency compensated time
+// (see merge.h)
+void handleMessage(TuningTable &tuning, AngleTable &angles, Voices &voices, PitchGlides &glides,
+                   ClockSync &clock, const libremidi::message &m, int source)
+{
+    if (clock.handle(m))
+    {
+        return;
+    }
 
-    while (midiMessageQueue.try_dequeue(m))
+    int channel = m.bytes[0] & 0x0F;
+    if (m.get_message_type() == libremidi::message_type::NOTE_ON)
     {
-        if (m.get_message_type() == libremidi::message_type::NOTE_ON)
+        int noteNumber = m.bytes[1];
+        int velocity = m.bytes[2];
+        if (velocity == 0)
         {
-            noteNumber = m.bytes[1];
-            velocity = m.bytes[2];
-            if (velocity == 0)
-            {
-                // Treat velocity 0 note-on as note-off (some MIDI controllers behave like this)
-                noteAngles.erase(noteNumber);
-            }
-            else if (noteAngles.size() < maxNotes)
-            {
-                // Map each new note to its angle in radians on the pitch circle
-                // Angle is proportional to note cents
-                freq = MTS_NoteToFrequency(c, noteNumber, 0);
-                noteAngles[noteNumber] = TWOPI * log2(freq / 440.0);
-            }
+            // Treat velocity 0 note-on as note-off (some MIDI controllers behave like this)
+            voices.noteOff(source, channel, noteNumber, m.timestamp);
         }
-        if (m.get_message_type() == libremidi::message_type::NOTE_OFF)
+        else
         {
-            // Remove notes we get a note-off for
-            noteAngles.erase(m.bytes[1]);
+            // Map each new note to its angle in radians on the pitch circle
+            // Checking the frequency first rebuilds the angle table if the tuning has changed
+            tuning.frequency(channel, noteNumber);
+            voices.noteOn(source, channel, noteNumber, velocity,
+                          angles.angle(channel, noteNumber), m.timestamp);
         }
     }
+    if (m.get_message_type() == libremidi::message_type::NOTE_OFF)
+    {
+        // Remove notes we get a note-off for, unless held by a pedal
+        voices.noteOff(source, channel, m.bytes[1], m.timestamp);
+    }
+    if (m.get_message_type() == libremidi::message_type::CONTROL_CHANGE)
+    {
+        // Track sustain and sostenuto pedals, and the pitch bend range
+        voices.controlChange(source, channel, m.bytes[1], m.bytes[2], m.timestamp);
+        glides.controlChange(source, channel, m.bytes[1], m.bytes[2], m.timestamp);
+        // Data entry can change the bend range, which moves bent notes as a bend does
+        if (clusters != nullptr && (m.bytes[1] == 6 || m.bytes[1] == 38))
+            clusters->pitchBend(source, channel);
+    }
+    if (m.get_message_type() == libremidi::message_type::PITCH_BEND)
+    {
+        glides.pitchBend(source, channel, m.bytes[1] | m.bytes[2] << 7, m.timestamp);
+        if (clusters != nullptr)
+            clusters->pitchBend(source, channel);
+    }
 }
 
-// Draw points for notes, edges for intervals, and the pitch circle
-void draw(ShaderPrograms shaders, unsigned int VAO[], std::map<char, float> noteAngles)
+// Update the voices based on midi messages received, in latency compensated order
+void updateNoteAngles(TuningTable &tuning, AngleTable &angles, Voices &voices,
+                      PitchGlides &glides, ClockSync &clock)
 {
+    auto handle = [&](const SourcedMessage &e) {
+        handleMessage(tuning, angles, voices, glides, clock, e.message, e.source);
+    };
+    auto arrived = [](int port, const libremidi::message &m) {
+        // Pass on what was played here, but not what other instances sent us
+        if (networkPort >= 0 && port != networkPort)
+            network.share(m, m.timestamp - portLatencyNs[port]);
+    };
+    mergePorts(handle, arrived);
+    if (networkPort >= 0)
+        network.flush();
+
+    SourcedMessage e;
+    int64_t now = ingestClock();
+    while (releaseMessage(now, e))
+    {
+        handle(e);
+    }
+}
+
+// Record the interval histogram, drawn as a row of bars along the bottom of the canvas
+void drawIntervals(CommandList &commands, int tile, ShaderPrograms shaders, unsigned int VAO[],
+                   unsigned int texture, IntervalHistogram &intervals)
+{
+    // Bar heights only change when the histogram does, and are only set again when they change
+    static float heights[IntervalHistogram::numBins];
+    intervals.heights(heights);
+
+    DrawCommand bars{Layer::Intervals, tile, shaders.bars, VAO[3], texture,
+                     DrawCall{GL_TRIANGLE_STRIP, 4, IntervalHistogram::numBins}};
+    commands.add(bars, shaders.barHeights, heights, IntervalHistogram::numBins);
+}
+
+// Record the lattice view, drawn in a panel at the top right of the canvas
+void drawLattice(CommandList &commands, int tile, ShaderPrograms shaders, unsigned int VAO[],
+                 LatticeView &lattice)
+{
+    // Node and edge positions only need uploading when the sounding notes change
+    if (lattice.changed)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            const std::vector<float> &data = i == 0 ? lattice.nodes : lattice.edges;
+            renderer->updateVertices(latticeVBO[i], data.data(), data.size() * sizeof(float));
+        }
+        lattice.changed = false;
+    }
+
+    // Keep the panel square whatever the window's aspect ratio
+    float panel[4] = {1.0f - 0.25f * scaleX, 1.0f - 0.25f * scaleY, 0.22f * scaleX,
+                      0.22f * scaleY};
+
+    DrawCommand edges{Layer::LatticeEdges, tile, shaders.latticeEdge, VAO[5], 0,
+                      DrawCall{GL_TRIANGLE_STRIP, 4, (int)lattice.edges.size() / 4}};
+    commands.add(edges, shaders.latticeEdgePanel, panel, 4, true);
+
+    DrawCommand nodes{Layer::LatticeNodes, tile, shaders.latticeNode, VAO[4], 0,
+                      DrawCall{GL_TRIANGLE_STRIP, 4, (int)lattice.nodes.size() / 2}};
+    commands.add(nodes, shaders.latticeNodePanel, panel, 4, true);
+}
+
+// Rotation of the pitch circle, and how strongly it pulses
+struct Animation
+{
+    float rotation;
+    float pulse;
+};
+
+/**
+ * Work out the animation for this frame
+ *
+ * When following MIDI clock the circle turns once every beatsPerTurn beats and pulses on each
+ * beat. Otherwise it turns slowly at a fixed rate.
+ */
+Animation animate(const ClockSync &clock, bool clockSync, double beatsPerTurn)
+{
+    if (!clockSync)
+    {
+        return Animation{(float)(0.01 * glfwGetTime()), 0.0f};
+    }
+    // Ticks are released from the jitter buffer on the latency compensated clock
+    double beats = clock.beats(ingestClock() - maxLatencyNs);
+    double turns = beats / beatsPerTurn;
+    float pulse = clock.locked() ? std::exp(-6.0 * (beats - std::floor(beats))) : 0.0f;
+    return Animation{(float)(TWOPI * (turns - std::floor(turns))), pulse};
+}
+
+/**
+ * Draw points for notes, edges for intervals, and the pitch circle, with the interval histogram
+ * and lattice if they are shown
+ *
+ * Everything is drawn once per tile, into the tile's viewport. Note data and the uniforms of
+ * every tile are uploaded once beforehand. Draws are recorded into a command list in the frame
+ * arena, which issues them together once the whole frame is recorded.
+ */
+void draw(ShaderPrograms shaders, unsigned int VAO[], unsigned int texture, const Voices &voices,
+          PitchGlides &glides, const Pick &hover, Animation animation,
+          IntervalHistogram *intervals, LatticeView *lattice)
+{
+    // Clearing every buffer, even ones not used, saves tile-based GPUs loading them from memory
     glClearColor(5.0f / 255.0f, 1.0f / 255.0f, 74.0f / 255.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
-    float timeValue = glfwGetTime();
+    pushDebugGroup("Uniforms");
 
-    // Copy note angles into array to pass as a uniform to shaders
-    float noteAnglesArr[maxNotes] = {0.0f};
-    assert(noteAngles.size() <= maxNotes);
-    int i = 0;
-    for (const auto &v : std::views::values(noteAngles))
+    // With clustering only the first note of each cluster is drawn, standing for the rest
+    auto shown = [&](int slot) { return clusters == nullptr || clusters->shown(slot); };
+
+    // Note keyframes only need uploading when a note starts, stops or is bent
+    Keyframe keyframes[maxNotes];
+    if (glides.upload(keyframes, camera, shown))
     {
-        noteAnglesArr[i] = v;
-        i++;
+        renderer->updateKeyframes(keyframes);
+    }
+    int numNotes = clusters != nullptr ? clusters->size() : voices.size();
+
+    // Edge weights only need working out again when a pitch changes
+    if (edgeMetrics != nullptr)
+    {
+        float cents[maxNotes];
+        int n = 0;
+        for (int slot = 0; slot < maxNotes; slot++)
+        {
+            if (voices[slot].active && shown(slot))
+                cents[n++] = 1200.0 * std::log2(glides.frequency(voices[slot]) / 440.0);
+        }
+        edgeMetrics->update(cents, n, stateCache);
     }
 
-    glBindVertexArray(VAO[2]);
-    glUseProgram(shaders.circle);
-    glUniform1f(glGetUniformLocation(shaders.circle, "scaleX"), scaleX);
-    glUniform1f(glGetUniformLocation(shaders.circle, "scaleY"), scaleY);
-    glUniform1f(glGetUniformLocation(shaders.circle, "time"), timeValue);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 2 * N);
+    // Notes are placed where they will be when this frame reaches the screen, on the same
+    // latency compensated clock as the messages which moved them
+    uint32_t displayTime = keyframeTime(ingestClock() + framePeriodNs - maxLatencyNs);
 
-    glBindVertexArray(VAO[0]);
-    glUseProgram(shaders.line);
-    glUniform1f(glGetUniformLocation(shaders.line, "scaleX"), scaleX);
-    glUniform1f(glGetUniformLocation(shaders.line, "scaleY"), scaleY);
-    glUniform1fv(glGetUniformLocation(shaders.line, "noteAngles"), maxNotes, noteAnglesArr);
-    glDrawElements(GL_LINES, (noteAngles.size() * (noteAngles.size() - 1)), GL_UNSIGNED_INT, 0);
-
-    glBindVertexArray(VAO[1]);
-    glUseProgram(shaders.point);
-    glUniform1f(glGetUniformLocation(shaders.point, "scaleX"), scaleX);
-    glUniform1f(glGetUniformLocation(shaders.point, "scaleY"), scaleY);
-    glUniform1fv(glGetUniformLocation(shaders.point, "noteAngles"), maxNotes, noteAnglesArr);
-    glDrawArrays(GL_POINTS, 0, noteAngles.size());
+    // Shaders number notes by their order among the active slots, or clusters by their node
+    // number, and edges by note pairs in the order of the indices table
+    auto noteIndex = [&](int slot) {
+        if (clusters != nullptr)
+            return clusters->node(slot);
+        int n = 0;
+        for (int i = 0; i < slot; i++)
+            n += voices[i].active;
+        return n;
+    };
+    int highlightNote = -1, highlightEdge = -1;
+    if (hover.kind == Pick::Note)
+    {
+        highlightNote = noteIndex(hover.slot1);
+    }
+    if (hover.kind == Pick::Edge)
+    {
+        int i = std::min(noteIndex(hover.slot1), noteIndex(hover.slot2));
+        int j = std::max(noteIndex(hover.slot1), noteIndex(hover.slot2));
+        // Notes in one cluster have no edge between them
+        highlightEdge = i == j ? -1 : j * (j - 1) / 2 + i;
+    }
+
+    // Everything the shaders need for the frame goes up in one block per tile, differing only
+    // in the tile transform
+    FrameUniforms frames[TileLayout::maxTiles];
+    for (int t = 0; t < tiles.count(); t++)
+    {
+        FrameUniforms &frame = frames[t];
+        tiles.transform(t, frame.tile);
+        frame.scaleX = scaleX;
+        frame.scaleY = scaleY;
+        frame.zoom = camera.zoom;
+        frame.cameraAngle = camera.angle;
+        frame.displayTime = displayTime;
+        frame.highlightNote = highlightNote;
+        frame.highlightEdge = highlightEdge;
+        frame.rotation = animation.rotation;
+        frame.pulse = animation.pulse;
+        frame.arc = camera.visibleArc(scaleX, scaleY);
+        frame.consonance = edgeMetrics != nullptr;
+    }
+    renderer->beginFrame(frames, tiles.count());
+    popDebugGroup();
+
+    CommandList commands(&frameArena);
+
+    // Each note's disc is sized by how many notes it stands for
+    static const float ones[maxNotes] = {1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f,
+                                         1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f};
+    const float *multiplicity = clusters != nullptr ? clusters->multiplicities() : ones;
+
+    for (int t = 0; t < tiles.count(); t++)
+    {
+        commands.add({Layer::Circle, t, shaders.circle, VAO[2], 0,
+                      DrawCall{GL_TRIANGLE_STRIP, 2 * (N + 1)}});
+        commands.add(
+            {Layer::Edges, t, shaders.line, VAO[0], texture, renderer->edges(numNotes)});
+        commands.add({Layer::Notes, t, shaders.point, VAO[1], 0, renderer->notes(numNotes)},
+                     shaders.multiplicity, multiplicity, maxNotes);
+
+        if (intervals != nullptr)
+        {
+            drawIntervals(commands, t, shaders, VAO, texture, *intervals);
+        }
+        if (lattice != nullptr)
+        {
+            drawLattice(commands, t, shaders, VAO, *lattice);
+        }
+    }
+    commands.submit(*renderer, tiles, stateCache);
 }
 
-int main()
+// Set by SIGINT or SIGTERM to stop running headless
+static volatile std::sig_atomic_t stopRequested = 0;
+
+void requestStop(int signal) { stopRequested = 1; }
+
+/**
+ * Run without a window
+ *
+ * No window, GL context or shaders are created, so this starts at once and runs on machines
+ * without a display. Notes are still taken in, tuned and tracked, and go out through note
+ * sharing and session recording as usual. Runs until interrupted, then prints diagnostics.
+ */
+int runHeadless(const Options &options)
 {
-    GLFWwindow *window = setupWindow();
+    setupMIDI(options);
+    setupNetwork(options);
+    if (networkPort < 0 && options.recordPath.empty())
+    {
+        std::cout << "Running headless with neither --share nor --record, nothing will be output"
+                  << std::endl;
+    }
+
+    MTSClient *c = MTS_RegisterClient();
 
-    unsigned int VAO[3];
+    TuningTable tuning(c);
+    AngleTable angles(tuning, options.mapping);
+
+    Voices voices(options.overflow);
+
+    PitchGlides glides(tuning, angles, voices);
+    voices.addListener(&glides);
+
+    ClockSync clock;
+
+    SessionRecorder sessionRecorder(tuning);
+    if (!options.recordPath.empty() && sessionRecorder.start(options.recordPath))
+    {
+        recorder = &sessionRecorder;
+        voices.addListener(&sessionRecorder);
+    }
+
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+
+    // Without frames to pace it, poll often enough that latency compensation stays accurate
+    std::cout << std::this_thread::get_id() << " Starting headless loop" << std::endl;
+    while (!stopRequested)
+    {
+        updateNoteAngles(tuning, angles, voices, glides, clock);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    printDiagnostics();
+    network.stop();
+    sessionRecorder.stop(ingestClock() - maxLatencyNs);
+    MTS_DeregisterClient(c);
+    return 0;
+}
+
+// Start sending frames to shared memory if asked to, with room for the largest the window can be
+void setupFrameSink(GLFWwindow *window, const Options &options, FrameSink &sink)
+{
+    if (options.frameSinkName.empty())
+    {
+        return;
+    }
+    // The framebuffer can be larger than the window on high resolution displays
+    int width, height, framebufferWidth, framebufferHeight;
+    glfwGetWindowSize(window, &width, &height);
+    glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+    GLFWmonitor *monitor = glfwGetWindowMonitor(window);
+    const GLFWvidmode *mode = glfwGetVideoMode(monitor ? monitor : glfwGetPrimaryMonitor());
+    int maxWidth = std::max(framebufferWidth, mode->width * framebufferWidth / width);
+    int maxHeight = std::max(framebufferHeight, mode->height * framebufferHeight / height);
+    if (sink.start(options.frameSinkName, maxWidth, maxHeight))
+    {
+        frameSink = &sink;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Options options = parseOptions(argc, argv);
+    if (options.headless)
+    {
+        return runHeadless(options);
+    }
+
+    tiles = options.tiles;
+    GLFWwindow *window = setupWindow(options);
+
+    unsigned int VAO[6];
     setupVertices(VAO);
 
-    setupMIDI();
+    setupMIDI(options);
+    setupNetwork(options);
 
-    ShaderPrograms shaders = compileShaders();
+    bool compute = options.consonance && computeSupported(renderer->es());
+    ShaderPrograms shaders = compileShaders(*renderer, compute);
+    bindUniformBlocks(shaders);
 
+    // The edge shaders always read the metrics buffer, so it exists even when unused
+    EdgeMetrics metrics(shaders.edgeMetrics);
+    if (options.consonance)
+    {
+        edgeMetrics = &metrics;
+        std::cout << "Edge metrics on the " << (metrics.gpu() ? "GPU" : "CPU") << std::endl;
+    }
+
+    // Edge colours are looked up in the texture draws bind to unit 0
     unsigned int texture = loadTexture();
-    glUniform1i(glGetUniformLocation(shaders.line, "rainbow"), texture);
+    stateCache.useProgram(shaders.line);
+    glUniform1i(glGetUniformLocation(shaders.line, "rainbow"), 0);
 
     MTSClient *c = MTS_RegisterClient();
 
-    std::map<char, float> noteAngles; // {{0, 0.0}, {1, 0.1}, {2, 3.14}, {3, 5.0}};
+    TuningTable tuning(c);
+    AngleTable angles(tuning, options.mapping);
+
+    Voices voices(options.overflow);
+
+    PitchGlides glides(tuning, angles, voices);
+    voices.addListener(&glides);
+
+    ClockSync clock;
+
+    PickIndex pickIndex;
+    Pick hover;
+
+    SessionRecorder sessionRecorder(tuning);
+    if (!options.recordPath.empty() && sessionRecorder.start(options.recordPath))
+    {
+        recorder = &sessionRecorder;
+        voices.addListener(&sessionRecorder);
+    }
+
+    // Only made when shown, as its expiry queue is large
+    std::optional<IntervalHistogram> intervals;
+    if (options.intervalWindow > 0)
+    {
+        intervals.emplace(options.intervalWindow);
+        voices.addListener(&*intervals);
+    }
+
+    LatticeView lattice(tuning, options.latticeReference);
+    if (options.lattice)
+    {
+        voices.addListener(&lattice);
+    }
+
+    NoteClusters noteClusters(tuning, glides, voices, options.clusterCents);
+    if (options.clusterCents > 0.0)
+    {
+        clusters = &noteClusters;
+        voices.addListener(&noteClusters);
+    }
+
+    FrameSink sink;
+    setupFrameSink(window, options, sink);
+
+    if (options.maxFrameRate > 0.0)
+    {
+        pacer = new FramePacer(options.maxFrameRate);
+    }
 
     std::cout << std::this_thread::get_id() << " Starting main loop" << std::endl;
 
+    uint64_t frame = 0;
+    int64_t lastFrame = ingestClock();
+    int64_t reportFrameRateAt = lastFrame + 2000000000;
     while (!glfwWindowShouldClose(window))
     {
-        processInput(window);
-        updateNoteAngles(c, noteAngles);
-        draw(shaders, VAO, noteAngles);
+#ifndef NDEBUG
+        uint64_t allocations = heapAllocations;
+#endif
+        // Waiting at the start of the frame rather than the end keeps input and notes fresh
+        if (pacer != nullptr)
+        {
+            pacer->wait();
+        }
+        processInput(window, angles);
+        updateNoteAngles(tuning, angles, voices, glides, clock);
+        processPicking(window, pickIndex, voices, glides, hover);
+        Animation animation = animate(clock, options.clockSync, options.beatsPerTurn);
+        if (intervals)
+        {
+            intervals->expire(ingestClock() - maxLatencyNs);
+        }
+        draw(shaders, VAO, texture, voices, glides, hover, animation,
+             intervals ? &*intervals : nullptr, options.lattice ? &lattice : nullptr);
+        if (frameSink != nullptr)
+        {
+            int width, height;
+            glfwGetFramebufferSize(window, &width, &height);
+            frameSink->capture(width, height, ingestClock());
+        }
+        renderer->endFrame();
+        frame++;
         glfwSwapBuffers(window);
         glfwPollEvents();
+        frameArena.reset();
+
+        int64_t now = ingestClock();
+        framePeriodNs += (now - lastFrame - framePeriodNs) / 16;
+        lastFrame = now;
+
+        // Once settled, report the rate frames are actually shown at
+        if (reportFrameRateAt != 0 && now > reportFrameRateAt)
+        {
+            std::cout << "Measured frame rate: " << 1e9 / framePeriodNs << " Hz" << std::endl;
+            reportFrameRateAt = 0;
+        }
+
+#ifndef NDEBUG
+        // Once warmed up, the loop must not touch the heap: per frame data goes in the frame
+        // arena. Reported rather than asserted, as debug builds are the default
+        if (frame > 10 && heapAllocations != allocations && allocatingFrames++ == 0)
+        {
+            std::cout << "ERROR::FRAME::HEAP_ALLOCATION " << heapAllocations - allocations
+                      << " allocations in frame " << frame << std::endl;
+        }
+#endif
     }
 
+    network.stop();
+    sessionRecorder.stop(ingestClock() - maxLatencyNs);
+    sink.stop();
     MTS_DeregisterClient(c);
-    glDeleteVertexArrays(3, VAO);
+    glDeleteVertexArrays(6, VAO);
+    delete renderer;
     glfwTerminate();
     return 0;
 }
 
-int WinMain() { return main(); }
+#ifdef _WIN32
+int WinMain() { return main(__argc, __argv); }
+#else
+int WinMain() { return main(0, nullptr); }
+#endif
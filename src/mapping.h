@@ -0,0 +1,136 @@
+/**
+ *  Mapping from pitch to angle on the pitch circle
+ *
+ *  Two kinds of layout:
+ *      period      angle is proportional to pitch, going once round the circle per period.
+ *                  The period is an octave by default, but can be a tritave (3/1) for
+ *                  Bohlen-Pierce, a stretched octave, or anything else.
+ *      generator   notes are placed by how many generator steps they are from the reference,
+ *                  going round the circle once every given number of steps. A 700 cent
+ *                  generator with 12 steps gives the circle of fifths.
+ *  Both measure pitch from A 440, which sits at the top of the circle.
+ *
+ *  The angle of every (channel, note) is baked into a table, which is rebuilt when the layout
+ *  or the tuning changes, so playing a note costs a lookup whatever the layout. Angles are kept
+ *  as doubles wrapped into [0, 2pi), so high notes are as precise as low ones.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "tuning.h"
+
+#ifndef TWOPI
+#define TWOPI 6.283185307179586
+#endif
+
+// Angle wrapped into [0, 2pi)
+inline double wrapAngle(double angle)
+{
+    double a = std::fmod(angle, TWOPI);
+    return a < 0.0 ? a + TWOPI : a;
+}
+
+// Angle wrapped into [-pi, pi), for differences between angles
+inline double signedAngle(double angle)
+{
+    return wrapAngle(angle + TWOPI / 2) - TWOPI / 2;
+}
+
+struct Mapping
+{
+    enum Layout
+    {
+        Period,
+        Generator
+    };
+
+    Layout layout = Period;
+    double periodCents = 1200.0;
+    double generatorCents = 700.0;
+    int generatorSteps = 12;
+
+    // Angle of a frequency in radians
+    double angle(double freq) const
+    {
+        double cents = 1200.0 * std::log2(freq / 440.0);
+        if (layout == Period)
+        {
+            return TWOPI * cents / periodCents;
+        }
+
+        // Find the number of generator steps which lands closest to the note, up to periods
+        double pitch = cents - periodCents * std::floor(cents / periodCents);
+        int bestStep = 0;
+        double bestDistance = periodCents;
+        for (int k = 0; k < generatorSteps; k++)
+        {
+            double d = std::fmod(k * generatorCents - pitch, periodCents);
+            d = std::min(std::abs(d), periodCents - std::abs(d));
+            if (d < bestDistance)
+            {
+                bestStep = k;
+                bestDistance = d;
+            }
+        }
+        return TWOPI * bestStep / generatorSteps;
+    }
+
+    // Angle a note turns through when bent by some cents. Generator layouts turn by the
+    // fraction of a generator step bent through rather than snapping to another step, so bends
+    // move notes continuously in either layout
+    double bendAngle(double cents) const
+    {
+        if (layout == Period)
+        {
+            return TWOPI * cents / periodCents;
+        }
+        return cents * (TWOPI / generatorSteps) / generatorCents;
+    }
+};
+
+class AngleTable
+{
+  public:
+    AngleTable(TuningTable &tuning, const Mapping &mapping) : tuning(tuning), mapping(mapping) {}
+
+    // Angle of a note under the current tuning and layout, in [0, 2pi)
+    double angle(int channel, int note)
+    {
+        if (builtGeneration != tuning.generation)
+        {
+            rebuild();
+        }
+        return angles[channel][note];
+    }
+
+    // Switch layout; notes already sounding keep their angles, as with tuning changes
+    void setMapping(const Mapping &m)
+    {
+        mapping = m;
+        rebuild();
+    }
+
+    const Mapping &getMapping() const { return mapping; }
+
+  private:
+    void rebuild()
+    {
+        for (int channel = 0; channel < 16; channel++)
+        {
+            for (int note = 0; note < 128; note++)
+            {
+                angles[channel][note] = wrapAngle(mapping.angle(tuning.cached(channel, note)));
+            }
+        }
+        builtGeneration = tuning.generation;
+    }
+
+    TuningTable &tuning;
+    Mapping mapping;
+    uint64_t builtGeneration = 0;
+    double angles[16][128];
+};
@@ -0,0 +1,301 @@
+/**
+ *  Merging of the per-port message queues into one stream in timestamp order
+ *
+ *  Each midi port's callback timestamps its messages and puts them on that port's own queue.
+ *  Different devices reach us with different fixed latencies, so notes played together on two
+ *  devices arrive staggered. Each port has a latency offset which is subtracted from its
+ *  timestamps, and messages then wait in a small jitter buffer until every port could have
+ *  delivered anything played at the same moment, i.e. until
+ *
+ *      arrival time - port latency + largest port latency <= now
+ *
+ *  With no latency offsets messages are released straight away.
+ *
+ *  Messages leave the jitter buffer stamped with their compensated time, arrival minus port
+ *  latency, so note and bend times line up across ports and with the display clock, which runs
+ *  the largest port latency behind (see releaseMessage).
+ *
+ *  Latencies can be set per port or estimated: while calibrating, play the same chord on
+ *  several devices at once. For each burst of note-ons the first arrival on every port is
+ *  compared with the first arrival on a reference port, and the median difference over recent
+ *  bursts becomes the port's latency.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include <libremidi/libremidi.hpp>
+#include <readerwriterqueue.h>
+
+#include "ingest.h"
+
+// A message and where it was played: 0 for the local ports, or 1 + the index of a peer sharing
+// its notes over the network, so each player's channels are kept apart (see voices.h)
+struct SourcedMessage
+{
+    libremidi::message message;
+    int source = 0;
+};
+
+using MessageQueue = moodycamel::ReaderWriterQueue<SourcedMessage, 4096>;
+
+// Queue used by each port's callback to pass messages to the main thread
+static MessageQueue *portQueues[maxPorts];
+static int numPorts = 0;
+
+// Fixed latency of each port, subtracted from its timestamps
+static int64_t portLatencyNs[maxPorts];
+
+// Largest of the port latencies, i.e. how long messages wait in the jitter buffer
+static int64_t maxLatencyNs = 0;
+
+void setPortLatency(int port, int64_t latencyNs)
+{
+    portLatencyNs[port] = latencyNs;
+    maxLatencyNs = *std::max_element(portLatencyNs, portLatencyNs + maxPorts);
+}
+
+/**
+ * Fixed capacity min-heap of messages ordered by compensated timestamp
+ *
+ * If it fills up the earliest message is released early rather than anything being dropped.
+ */
+class JitterBuffer
+{
+  public:
+    static constexpr int capacity = 256;
+
+    JitterBuffer() { heap.reserve(capacity); }
+
+    // Returns false if the buffer was full and out had to be released early. What is released
+    // early is the earliest of the buffer and the new message, so order is kept even then
+    bool push(int64_t time, SourcedMessage &&message, SourcedMessage &out)
+    {
+        bool forced = false;
+        if ((int)heap.size() == capacity)
+        {
+            forcedReleases++;
+            // The new message would sort after anything already held with the same time
+            if (time < heap.front().time)
+            {
+                out = std::move(message);
+                return false;
+            }
+            std::pop_heap(heap.begin(), heap.end(), later);
+            out = std::move(heap.back().message);
+            heap.pop_back();
+            forced = true;
+        }
+        heap.push_back(Entry{time, sequence++, std::move(message)});
+        std::push_heap(heap.begin(), heap.end(), later);
+        maxDepth = std::max(maxDepth, (int)heap.size());
+        return !forced;
+    }
+
+    // Pop the earliest message if it was timestamped no later than time
+    bool pop(int64_t time, SourcedMessage &out)
+    {
+        if (heap.empty() || heap.front().time > time)
+        {
+            return false;
+        }
+        std::pop_heap(heap.begin(), heap.end(), later);
+        out = std::move(heap.back().message);
+        heap.pop_back();
+        return true;
+    }
+
+    int depth() const { return heap.size(); }
+
+    int maxDepth = 0;
+    uint64_t forcedReleases = 0;
+
+  private:
+    struct Entry
+    {
+        int64_t time;
+        uint64_t sequence; // keeps messages with equal timestamps in arrival order
+        SourcedMessage message;
+    };
+
+    static bool later(const Entry &a, const Entry &b)
+    {
+        return a.time != b.time ? a.time > b.time : a.sequence > b.sequence;
+    }
+
+    std::vector<Entry> heap;
+    uint64_t sequence = 0;
+};
+
+static JitterBuffer jitterBuffer;
+
+// Latency estimation from bursts of note-ons played together on several devices
+class LatencyCalibration
+{
+  public:
+    // Note-ons within this long of the first one in a burst belong to the same burst
+    static constexpr int64_t burstNs = 150'000'000;
+    static constexpr int numSamples = 15;
+
+    bool active = false;
+
+    void start()
+    {
+        active = true;
+        reference = -1;
+        burstStart = -1;
+        numPortSamples.fill(0);
+        std::cout << "Latency calibration started: play chords across all devices" << std::endl;
+    }
+
+    // Stop and apply the estimated latencies
+    void finish()
+    {
+        closeBurst();
+        active = false;
+        int64_t estimates[maxPorts];
+        int64_t smallest = 0;
+        for (int port = 0; port < numPorts; port++)
+        {
+            estimates[port] = median(port);
+            smallest = std::min(smallest, estimates[port]);
+        }
+        std::cout << "Estimated port latencies:" << std::endl;
+        for (int port = 0; port < numPorts; port++)
+        {
+            if (port != reference && numPortSamples[port] == 0)
+            {
+                continue;
+            }
+            setPortLatency(port, estimates[port] - smallest);
+            std::cout << "    --latency " << port << ":" << portLatencyNs[port] / 1e6
+                      << std::endl;
+        }
+    }
+
+    // Called with each note-on's raw arrival time, before compensation
+    void noteOn(int port, int64_t time)
+    {
+        if (burstStart >= 0 && time - burstStart > burstNs)
+        {
+            closeBurst();
+        }
+        if (burstStart < 0)
+        {
+            burstStart = time;
+            firstArrival.fill(-1);
+        }
+        if (reference < 0)
+        {
+            reference = port;
+        }
+        if (firstArrival[port] < 0)
+        {
+            firstArrival[port] = time;
+        }
+    }
+
+  private:
+    void closeBurst()
+    {
+        if (burstStart < 0)
+        {
+            return;
+        }
+        burstStart = -1;
+        if (reference < 0 || firstArrival[reference] < 0)
+        {
+            return;
+        }
+        for (int port = 0; port < numPorts; port++)
+        {
+            if (port == reference || firstArrival[port] < 0)
+            {
+                continue;
+            }
+            samples[port][numPortSamples[port] % numSamples] =
+                firstArrival[port] - firstArrival[reference];
+            numPortSamples[port]++;
+        }
+    }
+
+    // Median latency of a port relative to the reference port
+    int64_t median(int port)
+    {
+        int n = std::min(numPortSamples[port], numSamples);
+        if (n == 0)
+        {
+            return 0;
+        }
+        int64_t *s = samples[port].data();
+        std::nth_element(s, s + n / 2, s + n);
+        return s[n / 2];
+    }
+
+    int reference = -1;
+    int64_t burstStart = -1;
+    std::array<int64_t, maxPorts> firstArrival;
+    std::array<std::array<int64_t, numSamples>, maxPorts> samples;
+    std::array<int, maxPorts> numPortSamples;
+};
+
+static LatencyCalibration latencyCalibration;
+
+/**
+ * Move everything the ports have delivered into the jitter buffer
+ *
+ * arrived is called with each message and its port as it is taken off the port's queue, still
+ * with its arrival time. If the buffer is full its earliest message is passed to handle straight
+ * away. Either way handle gets messages with their compensated time.
+ */
+template <typename Handler, typename Observer> void mergePorts(Handler &&handle, Observer &&arrived)
+{
+    SourcedMessage e;
+    SourcedMessage released;
+    for (int port = 0; port < numPorts; port++)
+    {
+        while (portQueues[port]->try_dequeue(e))
+        {
+            libremidi::message &m = e.message;
+            arrived(port, m);
+            if (latencyCalibration.active && messageType(m) == MessageNote &&
+                (m.bytes[0] & 0xF0) == 0x90 && m.bytes[2] != 0)
+            {
+                latencyCalibration.noteOn(port, m.timestamp);
+            }
+            m.timestamp -= portLatencyNs[port];
+            if (!jitterBuffer.push(m.timestamp, std::move(e), released))
+            {
+                handle(released);
+            }
+        }
+    }
+}
+
+// Take the next message which is due to be handled at time now, in compensated time order
+bool releaseMessage(int64_t now, SourcedMessage &m)
+{
+    return jitterBuffer.pop(now - maxLatencyNs, m);
+}
+
+void printMergeStats()
+{
+    std::cout << "Jitter buffer:" << std::endl;
+    std::cout << "    hold: " << maxLatencyNs / 1e6 << " ms" << std::endl;
+    std::cout << "    depth: " << jitterBuffer.depth() << " (max " << jitterBuffer.maxDepth
+              << ", capacity " << JitterBuffer::capacity << ")" << std::endl;
+    std::cout << "    released early (full): " << jitterBuffer.forcedReleases << std::endl;
+    for (int port = 0; port < numPorts; port++)
+    {
+        if (portLatencyNs[port] != 0)
+        {
+            std::cout << "    port " << port << " latency: " << portLatencyNs[port] / 1e6 << " ms"
+                      << std::endl;
+        }
+    }
+}
@@ -0,0 +1,170 @@
+/**
+ *  Consonance of every interval, for weighting edges
+ *
+ *  With --consonance, each edge is drawn wider the more consonant its interval. For every pair of
+ *  sounding notes the interval is matched to its nearest 7-limit just ratio, as the lattice view
+ *  matches notes (see nearestJustRatio in lattice.h), giving how far it is from the ratio in
+ *  cents and how complex the ratio is, ignoring octaves. The consonance weight falls off with
+ *  both, from 1 for a pure unison or octave.
+ *
+ *  Each edge gets a vec4 of (weight, error in cents, complexity, 0) in a buffer the edge shaders
+ *  read as a uniform block, indexed by edge as the indices table is. On GL 4.3 and later a
+ *  compute shader fills it, one invocation per edge, from a buffer of note pitches, so nothing
+ *  comes back to the CPU. Elsewhere the same values are worked out on the CPU and uploaded.
+ *  Either way it only happens when a pitch changes, as pitches are compared from frame to frame.
+ *
+ *  Edge colour still comes from the notes' angles in the edge shaders, as it follows each glide
+ *  from frame to frame.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+
+#include <glad/glad.h>
+
+#include "commands.h"
+#include "debug.h"
+#include "lattice.h"
+#include "voices.h"
+
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_UNIFORM_BARRIER_BIT
+#define GL_UNIFORM_BARRIER_BIT 0x00000004
+#endif
+
+// Binding point of the EdgeMetrics uniform block in shaders.h
+static constexpr unsigned int edgeMetricsBinding = 2;
+
+// Weight of an interval off a ratio by error cents, the ratio's complexity being the log2 of its
+// Tenney height with octaves left out; the compute shader in shaders.h matches this
+inline float consonanceWeight(float complexity, float error)
+{
+    float e = error / 20.0f;
+    return std::exp2(-complexity / 4.0f) * std::exp(-e * e);
+}
+
+// Whether the context can run compute shaders, which needs desktop GL 4.3
+inline bool computeSupported(bool es)
+{
+    int major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    return !es && (major > 4 || (major == 4 && minor >= 3));
+}
+
+class EdgeMetrics
+{
+  public:
+    // Compute on the GPU with the given compute program, or on the CPU if it is 0. The buffer
+    // is bound whether or not anything is ever computed, as the edge shaders always declare it
+    explicit EdgeMetrics(unsigned int program) : program(program)
+    {
+        float zeros[4 * maxEdges] = {};
+        glGenBuffers(1, &edgeBuffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, edgeBuffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(zeros), zeros, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, edgeMetricsBinding, edgeBuffer);
+        labelObject(GL_BUFFER, edgeBuffer, "Edge metrics");
+
+        if (program != 0)
+        {
+            loadFunction(dispatchCompute, "glDispatchCompute");
+            loadFunction(memoryBarrier, "glMemoryBarrier");
+            glGenBuffers(1, &noteBuffer);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, noteBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Notes), NULL, GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            labelObject(GL_BUFFER, noteBuffer, "Note pitches");
+        }
+        else
+        {
+            // Build the table of candidate ratios now rather than in the middle of a frame
+            nearestJustRatio(0.0);
+        }
+    }
+
+    bool gpu() const { return program != 0; }
+
+    // Work out the metrics of every pair of the first n notes, given their pitches in cents, if
+    // any pitch has changed
+    void update(const float cents[maxNotes], int n, StateCache &state)
+    {
+        if (n == notes.numNotes && std::equal(cents, cents + n, notes.cents))
+        {
+            return;
+        }
+        notes.numNotes = n;
+        std::copy(cents, cents + n, notes.cents);
+        updates++;
+
+        if (program != 0)
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, noteBuffer);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(Notes), &notes);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, noteBuffer);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, edgeBuffer);
+            state.useProgram(program);
+            int numEdges = n * (n - 1) / 2;
+            dispatchCompute((numEdges + 63) / 64, 1, 1);
+            // Edge draws read the results as uniforms
+            memoryBarrier(GL_UNIFORM_BARRIER_BIT);
+            return;
+        }
+
+        // Edges in the order of the indices table, each note paired with every earlier one
+        float edges[4 * maxEdges];
+        int k = 0;
+        for (int j = 1; j < n; j++)
+        {
+            for (int i = 0; i < j; i++, k++)
+            {
+                JustRatio ratio = nearestJustRatio(cents[j] - cents[i]);
+                float complexity = std::abs(ratio.e3) * std::log2(3.0f) +
+                                   std::abs(ratio.e5) * std::log2(5.0f) +
+                                   std::abs(ratio.e7) * std::log2(7.0f);
+                edges[4 * k] = consonanceWeight(complexity, ratio.errorCents);
+                edges[4 * k + 1] = ratio.errorCents;
+                edges[4 * k + 2] = complexity;
+                edges[4 * k + 3] = 0.0f;
+            }
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, edgeBuffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, 4 * k * sizeof(float), edges);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void printStats()
+    {
+        std::cout << "Edge metrics:" << std::endl;
+        std::cout << "    worked out " << updates << " times, on the "
+                  << (gpu() ? "GPU" : "CPU") << std::endl;
+    }
+
+  private:
+    // Note pitches laid out as the Notes buffer block of the compute shader
+    struct Notes
+    {
+        int32_t numNotes = -1;
+        float cents[maxNotes] = {};
+    };
+
+    unsigned int program;
+    unsigned int edgeBuffer = 0;
+    unsigned int noteBuffer = 0;
+    Notes notes;
+    uint64_t updates = 0;
+
+    void(APIENTRY *dispatchCompute)(GLuint, GLuint, GLuint) = nullptr;
+    void(APIENTRY *memoryBarrier)(GLbitfield) = nullptr;
+};
@@ -0,0 +1,456 @@
+/**
+ *  Sharing note events between chordagon instances over UDP multicast
+ *
+ *  Every instance joined to the same multicast group sends the messages arriving on its midi
+ *  ports to the group, and shows the messages the others send alongside its own. Messages are
+ *  batched, one packet per frame, and stamped with the sender's clock.
+ *
+ *  Clocks are aligned NTP-style. Once a second each instance multicasts a sync request holding
+ *  its send time t1. Each peer replies with t1, its receive time t2 and its reply time t3, and
+ *  the requester notes the arrival time t4. Then
+ *
+ *      offset = ((t2 - t1) + (t3 - t4)) / 2    peer clock minus our clock
+ *      delay  = (t4 - t1) - (t3 - t2)          round trip time
+ *
+ *  Of the last few samples from each peer, the one with the smallest delay is trusted, as it
+ *  was least disturbed by queueing.
+ *
+ *  A thread receives packets, converts timestamps to the local clock and puts the messages on
+ *  their own queue, which the main thread merges with the midi port queues like any other port.
+ *  Peers are only touched by that thread, which publishes each one's clock estimate through a
+ *  seqlock for the diagnostics to print.
+ *  Instances on the same machine see each other through multicast loopback, so sharing can be
+ *  tried by running several copies side by side.
+ *
+ *  Packet layout (little endian):
+ *      header      magic "CHRD", version (u8), type (u8), count (u16), sender id (u32)
+ *      events      count x {time (i64), status (u8), data1 (u8), data2 (u8), size (u8)}
+ *      sync req    t1 (i64)
+ *      sync reply  requester id (u32), t1 (i64), t2 (i64), t3 (i64)
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+using socket_t = SOCKET;
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+using socket_t = int;
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#endif
+
+#include <libremidi/libremidi.hpp>
+
+#include "ingest.h"
+#include "merge.h"
+#include "voices.h"
+
+class Network
+{
+  public:
+    static constexpr uint32_t magic = 0x44524843; // "CHRD"
+    static constexpr uint8_t version = 1;
+    static constexpr int maxPacketEvents = 96;
+    static constexpr int maxPeers = maxSources - 1; // source 0 is our own ports
+    static constexpr int numSyncSamples = 8;
+
+    // Join the multicast group and start receiving into queue
+    bool start(const std::string &group, int port, MessageQueue *queue)
+    {
+#ifdef _WIN32
+        WSADATA wsaData;
+        WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+        this->queue = queue;
+        sender = std::random_device{}();
+
+        sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (sock == INVALID_SOCKET)
+        {
+            std::cout << "ERROR::NETWORK::SOCKET_FAILED" << std::endl;
+            return false;
+        }
+
+        // Let several instances on one machine bind the same port
+        int yes = 1;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&yes, sizeof(yes));
+#ifdef SO_REUSEPORT
+        setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (const char *)&yes, sizeof(yes));
+#endif
+
+        sockaddr_in local{};
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(INADDR_ANY);
+        local.sin_port = htons(port);
+        if (bind(sock, (sockaddr *)&local, sizeof(local)) != 0)
+        {
+            std::cout << "ERROR::NETWORK::BIND_FAILED " << port << std::endl;
+            closesocket(sock);
+            return false;
+        }
+
+        ip_mreq membership{};
+        inet_pton(AF_INET, group.c_str(), &membership.imr_multiaddr);
+        membership.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char *)&membership,
+                       sizeof(membership)) != 0)
+        {
+            std::cout << "ERROR::NETWORK::JOIN_FAILED " << group << std::endl;
+            closesocket(sock);
+            return false;
+        }
+
+        // Stay on the local network, and hear other instances on this machine
+        unsigned char ttl = 1, loop = 1;
+        setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, (const char *)&ttl, sizeof(ttl));
+        setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, (const char *)&loop, sizeof(loop));
+
+        // Wake up regularly so the receive thread can send sync requests and notice stop()
+#ifdef _WIN32
+        DWORD timeout = 100;
+#else
+        timeval timeout{0, 100000};
+#endif
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout));
+
+        destination = sockaddr_in{};
+        destination.sin_family = AF_INET;
+        destination.sin_addr = membership.imr_multiaddr;
+        destination.sin_port = htons(port);
+
+        running = true;
+        receiver = std::thread(&Network::receive, this);
+        std::cout << "Sharing notes with " << group << ":" << port << std::endl;
+        return true;
+    }
+
+    void stop()
+    {
+        if (!running)
+        {
+            return;
+        }
+        running = false;
+        receiver.join();
+        closesocket(sock);
+    }
+
+    // Add a message which arrived at time (local clock) to the next packet
+    void share(const libremidi::message &m, int64_t time)
+    {
+        if (m.bytes.empty() || m.bytes.size() > 3 || m.bytes[0] >= 0xF0)
+        {
+            return;
+        }
+        if (numOutgoing == maxPacketEvents)
+        {
+            flush();
+        }
+        uint8_t *e = outgoing + headerSize + numOutgoing * eventSize;
+        put64(e, time);
+        for (size_t i = 0; i < 3; i++)
+        {
+            e[8 + i] = i < m.bytes.size() ? m.bytes[i] : 0;
+        }
+        e[11] = m.bytes.size();
+        numOutgoing++;
+    }
+
+    // Send the messages shared since the last flush as one packet
+    void flush()
+    {
+        if (numOutgoing == 0)
+        {
+            return;
+        }
+        putHeader(outgoing, Events, numOutgoing);
+        send(outgoing, headerSize + numOutgoing * eventSize);
+        numOutgoing = 0;
+    }
+
+    void printStats()
+    {
+        std::cout << "Network:" << std::endl;
+        std::cout << "    packets sent: " << packetsSent << ", received: " << packetsReceived
+                  << std::endl;
+        std::cout << "    events received: " << eventsReceived
+                  << ", dropped (queue full): " << eventsDropped << std::endl;
+        // Only peers we've synced with are published, so every one has a real estimate
+        int n = numPublished.load(std::memory_order_acquire);
+        for (int i = 0; i < n; i++)
+        {
+            uint32_t id = published[i].id.load(std::memory_order_relaxed);
+            SyncSample s = published[i].read();
+            std::cout << "    peer " << std::hex << id << std::dec << ": offset "
+                      << s.offset / 1e6 << " ms, round trip " << s.delay / 1e6 << " ms"
+                      << std::endl;
+        }
+    }
+
+  private:
+    enum PacketType : uint8_t
+    {
+        Events,
+        SyncRequest,
+        SyncReply
+    };
+
+    static constexpr int headerSize = 12;
+    static constexpr int eventSize = 12;
+    static constexpr int maxPacketSize = headerSize + maxPacketEvents * eventSize;
+
+    struct SyncSample
+    {
+        int64_t offset = 0;
+        int64_t delay = INT64_MAX;
+    };
+
+    struct Peer
+    {
+        uint32_t id = 0;
+        SyncSample samples[numSyncSamples];
+        int numSamples = 0;
+        int published = -1; // index into published, once synced with
+
+        const SyncSample &best() const
+        {
+            return *std::min_element(samples, samples + numSyncSamples,
+                                     [](auto &a, auto &b) { return a.delay < b.delay; });
+        }
+    };
+
+    // A peer's best clock estimate, written by the receive thread and read by the main thread.
+    // The sequence is odd while a write is under way, so a reader which sees it change or odd
+    // read a mix of two estimates and tries again
+    struct PublishedPeer
+    {
+        std::atomic<uint32_t> id = 0;
+        std::atomic<uint32_t> sequence = 0;
+        std::atomic<int64_t> offset = 0;
+        std::atomic<int64_t> delay = 0;
+
+        void write(const SyncSample &s)
+        {
+            uint32_t start = sequence.load(std::memory_order_relaxed);
+            sequence.store(start + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            offset.store(s.offset, std::memory_order_relaxed);
+            delay.store(s.delay, std::memory_order_relaxed);
+            sequence.store(start + 2, std::memory_order_release);
+        }
+
+        SyncSample read() const
+        {
+            SyncSample s;
+            uint32_t start;
+            do
+            {
+                start = sequence.load(std::memory_order_acquire);
+                s.offset = offset.load(std::memory_order_relaxed);
+                s.delay = delay.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+            } while ((start & 1) != 0 || start != sequence.load(std::memory_order_relaxed));
+            return s;
+        }
+    };
+
+    static void put32(uint8_t *p, uint32_t v)
+    {
+        for (int i = 0; i < 4; i++)
+            p[i] = v >> (8 * i);
+    }
+
+    static void put64(uint8_t *p, int64_t v)
+    {
+        for (int i = 0; i < 8; i++)
+            p[i] = (uint64_t)v >> (8 * i);
+    }
+
+    static uint32_t get32(const uint8_t *p)
+    {
+        uint32_t v = 0;
+        for (int i = 0; i < 4; i++)
+            v |= (uint32_t)p[i] << (8 * i);
+        return v;
+    }
+
+    static int64_t get64(const uint8_t *p)
+    {
+        uint64_t v = 0;
+        for (int i = 0; i < 8; i++)
+            v |= (uint64_t)p[i] << (8 * i);
+        return v;
+    }
+
+    void putHeader(uint8_t *p, PacketType type, int count)
+    {
+        put32(p, magic);
+        p[4] = version;
+        p[5] = type;
+        p[6] = count;
+        p[7] = count >> 8;
+        put32(p + 8, sender);
+    }
+
+    void send(const uint8_t *packet, int size)
+    {
+        if (sendto(sock, (const char *)packet, size, 0, (sockaddr *)&destination,
+                   sizeof(destination)) == size)
+        {
+            packetsSent++;
+        }
+    }
+
+    // Find the peer with the given id, adding it if there is room
+    Peer *peer(uint32_t id)
+    {
+        for (int i = 0; i < numPeers; i++)
+        {
+            if (peers[i].id == id)
+                return &peers[i];
+        }
+        if (numPeers == maxPeers)
+        {
+            return nullptr;
+        }
+        peers[numPeers].id = id;
+        return &peers[numPeers++];
+    }
+
+    // Make a peer's best estimate visible to printStats, listing the peer on its first sample
+    void publish(Peer &p)
+    {
+        if (p.published < 0)
+        {
+            p.published = numPublished.load(std::memory_order_relaxed);
+            published[p.published].id.store(p.id, std::memory_order_relaxed);
+            published[p.published].write(p.best());
+            numPublished.store(p.published + 1, std::memory_order_release);
+            return;
+        }
+        published[p.published].write(p.best());
+    }
+
+    // Runs on the receive thread
+    void receive()
+    {
+        uint8_t packet[maxPacketSize];
+        uint8_t reply[headerSize + 28];
+        int64_t lastSyncRequest = 0;
+
+        while (running)
+        {
+            int64_t now = ingestClock();
+            if (now - lastSyncRequest > 1'000'000'000)
+            {
+                uint8_t request[headerSize + 8];
+                putHeader(request, SyncRequest, 0);
+                put64(request + headerSize, now);
+                send(request, sizeof(request));
+                lastSyncRequest = now;
+            }
+
+            int size = recv(sock, (char *)packet, sizeof(packet), 0);
+            int64_t arrival = ingestClock();
+            if (size < headerSize || get32(packet) != magic || packet[4] != version)
+            {
+                continue;
+            }
+            uint32_t from = get32(packet + 8);
+            if (from == sender)
+            {
+                // Our own packet, looped back
+                continue;
+            }
+            packetsReceived++;
+
+            if (packet[5] == SyncRequest && size >= headerSize + 8)
+            {
+                putHeader(reply, SyncReply, 0);
+                put32(reply + headerSize, from);
+                std::memcpy(reply + headerSize + 4, packet + headerSize, 8);
+                put64(reply + headerSize + 12, arrival);
+                put64(reply + headerSize + 20, ingestClock());
+                send(reply, sizeof(reply));
+            }
+            else if (packet[5] == SyncReply && size >= headerSize + 28 &&
+                     get32(packet + headerSize) == sender)
+            {
+                int64_t t1 = get64(packet + headerSize + 4);
+                int64_t t2 = get64(packet + headerSize + 12);
+                int64_t t3 = get64(packet + headerSize + 20);
+                int64_t t4 = arrival;
+                if (Peer *p = peer(from))
+                {
+                    SyncSample &s = p->samples[p->numSamples++ % numSyncSamples];
+                    s.offset = ((t2 - t1) + (t3 - t4)) / 2;
+                    s.delay = (t4 - t1) - (t3 - t2);
+                    publish(*p);
+                }
+            }
+            else if (packet[5] == Events)
+            {
+                Peer *p = peer(from);
+                if (p == nullptr || p->numSamples == 0)
+                {
+                    // Can't place its events in time until we've synced with it
+                    continue;
+                }
+                int64_t offset = p->best().offset;
+                int count = std::min(packet[6] | packet[7] << 8, (size - headerSize) / eventSize);
+                for (int i = 0; i < count; i++)
+                {
+                    const uint8_t *e = packet + headerSize + i * eventSize;
+                    int n = std::clamp<int>(e[11], 1, 3);
+                    libremidi::message m{libremidi::midi_bytes(e + 8, e + 8 + n),
+                                         get64(e) - offset};
+                    eventsReceived++;
+                    // Each peer is a source of its own, so its channels don't mix with ours
+                    if (!queue->try_enqueue(SourcedMessage{std::move(m), 1 + int(p - peers)}))
+                    {
+                        eventsDropped++;
+                    }
+                }
+            }
+        }
+    }
+
+    socket_t sock = INVALID_SOCKET;
+    sockaddr_in destination{};
+    uint32_t sender = 0;
+    MessageQueue *queue = nullptr;
+    std::thread receiver;
+    std::atomic<bool> running = false;
+
+    uint8_t outgoing[maxPacketSize];
+    int numOutgoing = 0;
+
+    // Only touched by the receive thread
+    Peer peers[maxPeers];
+    int numPeers = 0;
+
+    // Clock estimates of the peers synced with, for the diagnostics
+    PublishedPeer published[maxPeers];
+    std::atomic<int> numPublished = 0;
+
+    std::atomic<uint64_t> packetsSent = 0;
+    std::atomic<uint64_t> packetsReceived = 0;
+    std::atomic<uint64_t> eventsReceived = 0;
+    std::atomic<uint64_t> eventsDropped = 0;
+};
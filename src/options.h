@@ -0,0 +1,411 @@
+/**
+ *  Command line options
+ *
+ *  Usage: chordagon [options]
+ *      --overflow <policy>     what to do when more than maxNotes notes are held:
+ *                              drop-newest, steal-oldest (default), steal-quietest,
+ *                              steal-farthest
+ *      --accept [port:]<types> midi message types to accept, on all ports or on one port:
+ *                              a comma separated list of note, cc, bend, pressure,
+ *                              program, sysex, clock, transport, sensing, other, all
+ *                              (default note,cc,bend)
+ *      --dedup <ports>         drop events repeated across ports, for a comma separated list
+ *                              of port numbers or all
+ *      --dedup-window <ms>     how close together repeats must be (default 5)
+ *      --latency <port>:<ms>   fixed latency of a port, compensated for by delaying the others
+ *      --share                 share notes with other instances over UDP multicast
+ *      --share-group <ip>:<port>
+ *                              multicast group to share on (default 239.255.42.99:21928)
+ *      --intervals <seconds>   show a histogram of the intervals played over this long
+ *      --lattice [note]        show a just intonation lattice, relative to a reference midi
+ *                              note (default 60)
+ *      --period <interval>     go round the circle once per interval (default 1200 cents)
+ *      --generator <interval>:<steps>
+ *                              lay notes out by steps of a generator instead, e.g. 700:12
+ *                              for the circle of fifths
+ *      --clock-sync [beats]    turn the circle in time with incoming MIDI clock, once every
+ *                              given number of beats (default 64)
+ *      --record <file>         write every note played to a columnar file (see recorder.h)
+ *      --renderer <tier>       auto (default), gl33, gl45 or gles30 (see renderer.h)
+ *      --samples <n>           multisampling samples (default 4, or 0 with GLES)
+ *      --headless              run without a window, only passing notes on through --share
+ *                              and --record
+ *      --frame-sink <name>     send every frame to other programs through shared memory
+ *                              with this name (see framesink.h)
+ *      --fullscreen [monitor]  go fullscreen on a monitor, by its number in the list printed
+ *                              (default the primary monitor)
+ *      --vsync <mode>          on, adaptive or off (default the driver's setting)
+ *      --max-fps <hz>          cap the frame rate, starting frames on a steady schedule
+ *      --tiles <columns>x<rows>[:<bezel>]
+ *                              split the window into tiles for a video wall, with bezel
+ *                              pixels hidden between neighbouring tiles (see tiles.h)
+ *      --consonance            draw edges wider the more consonant their interval (see
+ *                              metrics.h)
+ *      --cluster <cents>       draw notes within this many cents of each other as one (see
+ *                              clusters.h)
+ *      --help                  print this message
+ *
+ *  Intervals are given in cents, or as a ratio like 3/1.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <string_view>
+
+#include "display.h"
+#include "ingest.h"
+#include "mapping.h"
+#include "renderer.h"
+#include "tiles.h"
+#include "voices.h"
+
+struct Options
+{
+    OverflowPolicy overflow = OverflowPolicy::StealOldest;
+    uint32_t acceptMask = defaultAcceptMask;
+    std::map<int, uint32_t> portAcceptMasks;
+    uint64_t dedupPorts = 0;
+    double dedupWindowMs = 5.0;
+    std::map<int, double> portLatenciesMs;
+    bool share = false;
+    std::string shareGroup = "239.255.42.99";
+    int sharePort = 21928;
+    double intervalWindow = 0.0;
+    bool lattice = false;
+    int latticeReference = 60;
+    Mapping mapping;
+    bool clockSync = false;
+    double beatsPerTurn = 64.0;
+    std::string recordPath;
+    Renderer::Tier renderer = Renderer::Auto;
+    int samples = -1; // -1 for the default, which depends on the renderer
+    bool headless = false;
+    std::string frameSinkName;
+    TileLayout tiles;
+    bool fullscreen = false;
+    int monitor = -1; // -1 for the primary monitor
+    SwapMode swap = SwapMode::Default;
+    double maxFrameRate = 0.0; // 0 for no cap
+    bool consonance = false;
+    double clusterCents = 0.0; // 0 for no clustering
+};
+
+static void printUsage()
+{
+    std::cout << "Usage: chordagon [options]\n"
+                 "    --overflow <policy>   drop-newest, steal-oldest (default), steal-quietest,\n"
+                 "                          steal-farthest\n"
+                 "    --accept [port:]<types> midi message types to accept: comma separated\n"
+                 "                          note, cc, bend, pressure, program, sysex, clock,\n"
+                 "                          transport, sensing, other, all (default note,cc,bend)\n"
+                 "    --dedup <ports>       drop events repeated across ports: comma separated\n"
+                 "                          port numbers or all\n"
+                 "    --dedup-window <ms>   how close together repeats must be (default 5)\n"
+                 "    --latency <port>:<ms> fixed latency of a port, compensated for by delaying\n"
+                 "                          the others\n"
+                 "    --share               share notes with other instances over UDP multicast\n"
+                 "    --share-group <ip>:<port>\n"
+                 "                          multicast group to share on\n"
+                 "                          (default 239.255.42.99:21928)\n"
+                 "    --intervals <seconds> show a histogram of the intervals played over this\n"
+                 "                          long\n"
+                 "    --lattice [note]      show a just intonation lattice, relative to a\n"
+                 "                          reference midi note (default 60)\n"
+                 "    --period <interval>   go round the circle once per interval\n"
+                 "                          (default 1200 cents)\n"
+                 "    --generator <interval>:<steps>\n"
+                 "                          lay notes out by steps of a generator, e.g. 700:12\n"
+                 "                          for the circle of fifths\n"
+                 "    --clock-sync [beats]  turn the circle in time with incoming MIDI clock,\n"
+                 "                          once every given number of beats (default 64)\n"
+                 "    --record <file>       write every note played to a columnar file\n"
+                 "    --renderer <tier>     auto (default), gl33, gl45 or gles30\n"
+                 "    --samples <n>         multisampling samples (default 4, or 0 with GLES)\n"
+                 "    --headless            run without a window, only passing notes on through\n"
+                 "                          --share and --record\n"
+                 "    --frame-sink <name>   send every frame to shared memory with this name\n"
+                 "    --fullscreen [monitor] go fullscreen on a monitor (default the primary)\n"
+                 "    --vsync <mode>        on, adaptive or off (default the driver's setting)\n"
+                 "    --max-fps <hz>        cap the frame rate, starting frames on a steady\n"
+                 "                          schedule\n"
+                 "    --tiles <columns>x<rows>[:<bezel>]\n"
+                 "                          split the window into tiles for a video wall, with\n"
+                 "                          bezel pixels hidden between neighbouring tiles\n"
+                 "    --consonance          draw edges wider the more consonant their interval\n"
+                 "    --cluster <cents>     draw notes within this many cents of each other as\n"
+                 "                          one\n"
+                 "    --help                print this message\n"
+                 "Intervals are in cents, or ratios like 3/1.\n";
+}
+
+// Print an error and the usage message, then exit
+[[noreturn]] static void badOption(const std::string &message)
+{
+    std::cout << "ERROR::OPTIONS::" << message << "\n" << std::endl;
+    printUsage();
+    exit(-1);
+}
+
+// Parse an interval given in cents, or as a ratio like 3/1
+double parseInterval(const std::string &interval)
+{
+    size_t slash = interval.find('/');
+    double cents = slash == std::string::npos
+                       ? std::atof(interval.c_str())
+                       : 1200.0 * std::log2(std::atof(interval.substr(0, slash).c_str()) /
+                                            std::atof(interval.substr(slash + 1).c_str()));
+    if (!(cents > 0.0))
+        badOption("BAD_INTERVAL " + interval);
+    return cents;
+}
+
+// Parse a port number, calling badOption with message unless all of text is a whole number
+// of a port that can exist, so typos aren't taken as port 0
+int parsePort(std::string_view text, const std::string &message)
+{
+    int port = -1;
+    auto [rest, error] = std::from_chars(text.data(), text.data() + text.size(), port);
+    if (error != std::errc() || rest != text.data() + text.size() || port < 0 ||
+        port >= maxPorts)
+        badOption(message);
+    return port;
+}
+
+Options parseOptions(int argc, char *argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+
+        // Fetch the value following an option which takes one
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc)
+            {
+                badOption("MISSING_VALUE " + arg);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--help" || arg == "-h")
+        {
+            printUsage();
+            exit(0);
+        }
+        else if (arg == "--overflow")
+        {
+            std::string policy = value();
+            if (policy == "drop-newest")
+                options.overflow = OverflowPolicy::DropNewest;
+            else if (policy == "steal-oldest")
+                options.overflow = OverflowPolicy::StealOldest;
+            else if (policy == "steal-quietest")
+                options.overflow = OverflowPolicy::StealQuietest;
+            else if (policy == "steal-farthest")
+                options.overflow = OverflowPolicy::StealFarthest;
+            else
+                badOption("UNKNOWN_OVERFLOW_POLICY " + policy);
+        }
+        else if (arg == "--accept")
+        {
+            std::string accept = value();
+            size_t colon = accept.find(':');
+            uint32_t mask;
+            if (!parseMessageTypes(accept.substr(colon + 1), mask))
+                badOption("UNKNOWN_MESSAGE_TYPE " + accept);
+            if (colon == std::string::npos)
+            {
+                options.acceptMask = mask;
+            }
+            else
+            {
+                int port = parsePort(std::string_view(accept).substr(0, colon),
+                                     "BAD_PORT " + accept);
+                options.portAcceptMasks[port] = mask;
+            }
+        }
+        else if (arg == "--dedup")
+        {
+            std::string ports = value();
+            if (ports == "all")
+            {
+                options.dedupPorts = ~uint64_t(0);
+                continue;
+            }
+            size_t start = 0;
+            while (start <= ports.size())
+            {
+                size_t end = std::min(ports.find(',', start), ports.size());
+                int port = parsePort(std::string_view(ports).substr(start, end - start),
+                                     "BAD_PORT " + ports);
+                options.dedupPorts |= uint64_t(1) << port;
+                start = end + 1;
+            }
+        }
+        else if (arg == "--dedup-window")
+        {
+            options.dedupWindowMs = std::atof(value().c_str());
+        }
+        else if (arg == "--latency")
+        {
+            std::string latency = value();
+            size_t colon = latency.find(':');
+            if (colon == std::string::npos)
+                badOption("BAD_LATENCY " + latency);
+            int port = parsePort(std::string_view(latency).substr(0, colon),
+                                 "BAD_LATENCY " + latency);
+            const char *ms = latency.c_str() + colon + 1;
+            char *end;
+            double latencyMs = std::strtod(ms, &end);
+            if (end == ms || *end != '\0' || !(latencyMs >= 0.0))
+                badOption("BAD_LATENCY " + latency);
+            options.portLatenciesMs[port] = latencyMs;
+        }
+        else if (arg == "--share")
+        {
+            options.share = true;
+        }
+        else if (arg == "--share-group")
+        {
+            std::string group = value();
+            size_t colon = group.find(':');
+            if (colon == std::string::npos)
+                badOption("BAD_SHARE_GROUP " + group);
+            options.share = true;
+            options.shareGroup = group.substr(0, colon);
+            options.sharePort = std::atoi(group.substr(colon + 1).c_str());
+        }
+        else if (arg == "--intervals")
+        {
+            options.intervalWindow = std::atof(value().c_str());
+        }
+        else if (arg == "--lattice")
+        {
+            options.lattice = true;
+            if (i + 1 < argc && std::isdigit((unsigned char)argv[i + 1][0]))
+            {
+                options.latticeReference = std::clamp(std::atoi(argv[++i]), 0, 127);
+            }
+        }
+        else if (arg == "--period")
+        {
+            options.mapping.periodCents = parseInterval(value());
+        }
+        else if (arg == "--generator")
+        {
+            std::string generator = value();
+            size_t colon = generator.find(':');
+            if (colon == std::string::npos)
+                badOption("BAD_GENERATOR " + generator);
+            options.mapping.layout = Mapping::Generator;
+            options.mapping.generatorCents = parseInterval(generator.substr(0, colon));
+            options.mapping.generatorSteps = std::atoi(generator.substr(colon + 1).c_str());
+            if (options.mapping.generatorSteps < 1)
+                badOption("BAD_GENERATOR " + generator);
+        }
+        else if (arg == "--clock-sync")
+        {
+            options.clockSync = true;
+            if (i + 1 < argc && std::isdigit((unsigned char)argv[i + 1][0]))
+            {
+                options.beatsPerTurn = std::max(1.0, std::atof(argv[++i]));
+            }
+        }
+        else if (arg == "--record")
+        {
+            options.recordPath = value();
+        }
+        else if (arg == "--renderer")
+        {
+            std::string tier = value();
+            if (tier == "auto")
+                options.renderer = Renderer::Auto;
+            else if (tier == "gl33")
+                options.renderer = Renderer::GL33;
+            else if (tier == "gl45")
+                options.renderer = Renderer::GL45;
+            else if (tier == "gles30")
+                options.renderer = Renderer::GLES30;
+            else
+                badOption("BAD_RENDERER " + tier);
+        }
+        else if (arg == "--samples")
+        {
+            options.samples = std::clamp(std::atoi(value().c_str()), 0, 16);
+        }
+        else if (arg == "--headless")
+        {
+            options.headless = true;
+        }
+        else if (arg == "--frame-sink")
+        {
+            options.frameSinkName = value();
+        }
+        else if (arg == "--fullscreen")
+        {
+            options.fullscreen = true;
+            if (i + 1 < argc && std::isdigit((unsigned char)argv[i + 1][0]))
+            {
+                options.monitor = std::atoi(argv[++i]);
+            }
+        }
+        else if (arg == "--vsync")
+        {
+            std::string mode = value();
+            if (mode == "on")
+                options.swap = SwapMode::VSync;
+            else if (mode == "adaptive")
+                options.swap = SwapMode::Adaptive;
+            else if (mode == "off")
+                options.swap = SwapMode::Off;
+            else
+                badOption("BAD_VSYNC " + mode);
+        }
+        else if (arg == "--max-fps")
+        {
+            std::string rate = value();
+            options.maxFrameRate = std::atof(rate.c_str());
+            if (!(options.maxFrameRate > 0.0))
+                badOption("BAD_FRAME_RATE " + rate);
+        }
+        else if (arg == "--tiles")
+        {
+            std::string tiles = value();
+            size_t x = tiles.find('x');
+            size_t colon = tiles.find(':');
+            if (x == std::string::npos)
+                badOption("BAD_TILES " + tiles);
+            options.tiles.columns = std::atoi(tiles.substr(0, x).c_str());
+            options.tiles.rows = std::atoi(tiles.substr(x + 1, colon - x - 1).c_str());
+            if (colon != std::string::npos)
+                options.tiles.bezel = std::max(0, std::atoi(tiles.substr(colon + 1).c_str()));
+            if (options.tiles.columns < 1 || options.tiles.rows < 1 ||
+                options.tiles.count() > TileLayout::maxTiles)
+                badOption("BAD_TILES " + tiles);
+        }
+        else if (arg == "--consonance")
+        {
+            options.consonance = true;
+        }
+        else if (arg == "--cluster")
+        {
+            std::string cents = value();
+            options.clusterCents = std::atof(cents.c_str());
+            if (!(options.clusterCents > 0.0))
+                badOption("BAD_CLUSTER " + cents);
+        }
+        else
+        {
+            badOption("UNKNOWN_OPTION " + arg);
+        }
+    }
+    return options;
+}
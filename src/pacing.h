@@ -0,0 +1,129 @@
+/**
+ *  Capping the frame rate with a steady cadence
+ *
+ *  With vsync off the main loop would otherwise run flat out. The pacer starts each frame on a
+ *  fixed schedule instead, waiting in two parts: it sleeps until shortly before the frame is
+ *  due, which costs no CPU, then spins for the rest, as sleeps wake up late by anything from
+ *  tens of microseconds to a millisecond or more. How long to spin is learned from how late
+ *  sleeps have been waking up, so the spin stays as short as the system allows.
+ *
+ *  Times are taken from a monotonic clock, and sleeps are to an absolute time on it, so
+ *  nothing drifts: on Linux CLOCK_MONOTONIC with clock_nanosleep, elsewhere
+ *  std::chrono::steady_clock with sleep_until. If a frame runs so late that the next is already
+ *  due, the schedule starts again from now rather than rushing frames out to catch up.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+
+#ifdef __linux__
+#include <cerrno>
+#include <time.h>
+#endif
+
+class FramePacer
+{
+  public:
+    explicit FramePacer(double hz) : periodNs(1e9 / hz) { next = now() + periodNs; }
+
+    // Wait until the next frame is due
+    void wait()
+    {
+        int64_t sleepUntil = next - spinNs;
+        if (sleepUntil > now())
+        {
+            sleep(sleepUntil);
+            // Learn how late sleeps wake, allowing twice the recent average as the margin
+            int64_t late = std::max<int64_t>(0, now() - sleepUntil);
+            lateNs += (late - lateNs) / 8;
+            spinNs = std::clamp<int64_t>(2 * lateNs, minSpinNs, maxSpinNs);
+        }
+        int64_t spinStart = now();
+        while (now() < next)
+        {
+        }
+
+        // How far from the schedule the frame started
+        int64_t t = now();
+        double error = t - next;
+        frames++;
+        errorSum += error;
+        errorSquaredSum += error * error;
+        maxError = std::max(maxError, std::abs(error));
+        spinSum += t - spinStart;
+
+        next += periodNs;
+        if (next <= t)
+        {
+            missed++;
+            next = t + periodNs;
+        }
+    }
+
+    void printStats()
+    {
+        std::cout << "Frame pacing:" << std::endl;
+        if (frames == 0)
+        {
+            return;
+        }
+        double mean = errorSum / frames;
+        double deviation = std::sqrt(std::max(0.0, errorSquaredSum / frames - mean * mean));
+        std::cout << "    target " << 1e9 / periodNs << " Hz, frames: " << frames
+                  << ", missed: " << missed << std::endl;
+        std::cout << "    start error mean " << mean / 1e3 << " us, deviation " << deviation / 1e3
+                  << " us, max " << maxError / 1e3 << " us" << std::endl;
+        std::cout << "    spin margin " << spinNs / 1e3 << " us, mean spin "
+                  << spinSum / frames / 1e3 << " us per frame" << std::endl;
+    }
+
+  private:
+    static constexpr int64_t minSpinNs = 100000;
+    static constexpr int64_t maxSpinNs = 4000000;
+
+    static int64_t now()
+    {
+#ifdef __linux__
+        timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return t.tv_sec * 1000000000LL + t.tv_nsec;
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+#endif
+    }
+
+    static void sleep(int64_t until)
+    {
+#ifdef __linux__
+        timespec t{(time_t)(until / 1000000000), (long)(until % 1000000000)};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR)
+        {
+        }
+#else
+        // macOS has no clock_nanosleep, and Windows no absolute sleeps of its own
+        std::this_thread::sleep_until(std::chrono::steady_clock::time_point(
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::nanoseconds(until))));
+#endif
+    }
+
+    int64_t periodNs;
+    int64_t next;
+    int64_t spinNs = 1000000;
+    int64_t lateNs = 500000;
+
+    uint64_t frames = 0;
+    uint64_t missed = 0;
+    double errorSum = 0.0;
+    double errorSquaredSum = 0.0;
+    double maxError = 0.0;
+    double spinSum = 0.0;
+};
@@ -0,0 +1,229 @@
+/**
+ *  Finding the note or edge under the mouse
+ *
+ *  Notes are few enough to test one by one, but the number of edges grows with the square of
+ *  the number of notes, so edges are kept in a polar grid over the disc: a few rings, each cut
+ *  into sectors. Each edge is entered in every cell it passes through, and a pick only tests the
+ *  edges in the cells around the mouse.
+ *
+ *  The grid is kept up to date incrementally. Once per frame sync compares each voice slot with
+ *  what it held last time, and only the edges of notes which started, stopped or moved are taken
+ *  out of or put into the grid, so held notes cost a comparison each.
+ *
+ *  Positions are on the unzoomed circle, in the same units as the shaders before the aspect
+ *  ratio correction, with notes on a circle of radius 0.8 and angle measured clockwise from the
+ *  top. Points on screen are brought back to the unzoomed circle with Camera::unproject.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+#include "glide.h"
+#include "voices.h"
+
+#ifndef TWOPI
+#define TWOPI 6.283185307179586
+#endif
+
+// What is under the mouse: a note, an edge between two notes, or nothing
+struct Pick
+{
+    enum Kind
+    {
+        None,
+        Note,
+        Edge
+    };
+
+    Kind kind = None;
+    int slot1 = -1; // voice slot of the note, or of one end of the edge
+    int slot2 = -1; // voice slot of the other end of the edge
+
+    bool operator==(const Pick &other) const = default;
+};
+
+class PickIndex
+{
+  public:
+    // Grid resolution; the innermost ring is a single cell, as its sectors would be tiny
+    static constexpr int numRings = 8;
+    static constexpr int numSectors = 64;
+    static constexpr float outerRadius = 0.85f;
+
+    // How close the mouse must be to count as over a note or an edge
+    static constexpr float noteTolerance = 0.035f;
+    static constexpr float edgeTolerance = 0.015f;
+
+    PickIndex() { angles.fill(NAN); }
+
+    // Bring the grid up to date with the voices and where their glides are heading
+    void sync(const Voices &voices, const PitchGlides &glides)
+    {
+        for (int slot = 0; slot < maxNotes; slot++)
+        {
+            double angle = voices[slot].active ? glides.target(slot) : NAN;
+            bool wasActive = !std::isnan(angles[slot]);
+            if (angle == angles[slot] || (!wasActive && std::isnan(angle)))
+            {
+                continue;
+            }
+            if (wasActive)
+            {
+                forEachEdge(slot, [&](int key) { removeEdge(key); });
+            }
+            angles[slot] = angle;
+            if (!std::isnan(angle))
+            {
+                forEachEdge(slot, [&](int key) { addEdge(key); });
+            }
+        }
+    }
+
+    // Note or edge nearest to a point, if it is close enough; zoom shrinks the tolerances
+    Pick pick(float x, float y, float zoom = 1.0f) const
+    {
+        Pick best;
+        float bestDistance = noteTolerance / zoom;
+        for (int slot = 0; slot < maxNotes; slot++)
+        {
+            if (std::isnan(angles[slot]))
+                continue;
+            float dx = x - noteX(angles[slot]);
+            float dy = y - noteY(angles[slot]);
+            float d = std::sqrt(dx * dx + dy * dy);
+            if (d < bestDistance)
+            {
+                best = Pick{Pick::Note, slot, -1};
+                bestDistance = d;
+            }
+        }
+        if (best.kind == Pick::Note)
+        {
+            return best;
+        }
+
+        // Edges passing near the point are entered in its cell or one of the cells around it
+        bestDistance = edgeTolerance / zoom;
+        int ring = ringOf(x, y);
+        int sector = sectorOf(x, y);
+        for (int r = std::max(0, ring - 1); r <= std::min(numRings - 1, ring + 1); r++)
+        {
+            for (int s = sector - 1; s <= sector + 1; s++)
+            {
+                for (uint16_t key : cells[cellOf(r, (s + numSectors) % numSectors)])
+                {
+                    float d = distanceToEdge(key, x, y);
+                    if (d < bestDistance)
+                    {
+                        best = Pick{Pick::Edge, key / maxNotes, key % maxNotes};
+                        bestDistance = d;
+                    }
+                }
+            }
+        }
+        return best;
+    }
+
+  private:
+    static float noteX(double angle) { return 0.8 * std::sin(angle); }
+    static float noteY(double angle) { return 0.8 * std::cos(angle); }
+
+    static int ringOf(float x, float y)
+    {
+        float r = std::sqrt(x * x + y * y);
+        return std::min(numRings - 1, (int)(r / outerRadius * numRings));
+    }
+
+    static int sectorOf(float x, float y)
+    {
+        float a = std::atan2(x, y) / (float)TWOPI;
+        int s = (int)std::floor((a - std::floor(a)) * numSectors);
+        return std::min(s, numSectors - 1);
+    }
+
+    static int cellOf(int ring, int sector) { return ring == 0 ? 0 : ring * numSectors + sector; }
+
+    // Call f with the key of every edge between slot and another sounding note
+    template <typename F> void forEachEdge(int slot, F f) const
+    {
+        for (int other = 0; other < maxNotes; other++)
+        {
+            if (other != slot && !std::isnan(angles[other]))
+            {
+                f(std::min(slot, other) * maxNotes + std::max(slot, other));
+            }
+        }
+    }
+
+    // Call f with each cell an edge passes through, by walking along it in short steps
+    template <typename F> void forEachCell(int key, F f) const
+    {
+        double a1 = angles[key / maxNotes], a2 = angles[key % maxNotes];
+        float x1 = noteX(a1), y1 = noteY(a1), x2 = noteX(a2), y2 = noteY(a2);
+        int steps = 1 + (int)(std::hypot(x2 - x1, y2 - y1) / 0.01f);
+        int previous = -1;
+        for (int i = 0; i <= steps; i++)
+        {
+            float t = (float)i / steps;
+            float x = x1 + t * (x2 - x1), y = y1 + t * (y2 - y1);
+            int cell = cellOf(ringOf(x, y), sectorOf(x, y));
+            if (cell != previous)
+            {
+                f(cell);
+                previous = cell;
+            }
+        }
+    }
+
+    void addEdge(int key)
+    {
+        forEachCell(key, [&](int cell) {
+            Cell &c = cells[cell];
+            if (std::find(c.begin(), c.end(), key) == c.end())
+                c.keys[c.size++] = key;
+        });
+    }
+
+    void removeEdge(int key)
+    {
+        forEachCell(key, [&](int cell) {
+            Cell &c = cells[cell];
+            uint16_t *it = std::find(c.begin(), c.end(), key);
+            if (it != c.end())
+            {
+                *it = c.keys[--c.size];
+            }
+        });
+    }
+
+    float distanceToEdge(int key, float x, float y) const
+    {
+        double a1 = angles[key / maxNotes], a2 = angles[key % maxNotes];
+        float x1 = noteX(a1), y1 = noteY(a1);
+        float dx = noteX(a2) - x1, dy = noteY(a2) - y1;
+        float t = std::clamp(((x - x1) * dx + (y - y1) * dy) / (dx * dx + dy * dy), 0.0f, 1.0f);
+        return std::hypot(x - x1 - t * dx, y - y1 - t * dy);
+    }
+
+    // Angle each slot was entered in the grid with, NaN for slots not sounding
+    std::array<double, maxNotes> angles;
+
+    // Edge keys (lower slot * maxNotes + higher slot) in a cell, with room for every edge so
+    // the grid never allocates
+    struct Cell
+    {
+        std::array<uint16_t, maxEdges> keys;
+        int size = 0;
+
+        uint16_t *begin() { return keys.data(); }
+        uint16_t *end() { return keys.data() + size; }
+        const uint16_t *begin() const { return keys.data(); }
+        const uint16_t *end() const { return keys.data() + size; }
+    };
+
+    std::array<Cell, numRings * numSectors> cells;
+};
@@ -0,0 +1,334 @@
+/**
+ *  Recording a session's notes to a columnar file for later analysis
+ *
+ *  Each note is recorded when it stops, as one row: onset, duration, channel, note, velocity,
+ *  frequency, angle and the id of the set of concurrent notes it joined. Notes started within
+ *  a few tens of milliseconds of each other, with no note stopping in between, are one set, so
+ *  the notes of a chord share an id. Rows go onto a fixed size queue, and a background thread
+ *  gathers them into blocks and writes them out, so the main loop never waits on the disk and
+ *  memory use stays bounded however long the session.
+ *
+ *  File layout, all integers little-endian:
+ *      header      "CHRDSESS", u32 version, i64 session start (ns since the unix epoch),
+ *                  u32 column count, then per column: u8 name length, name, u8 type (0 int64,
+ *                  1 float64), u8 encoding
+ *      blocks      u32 row count, then per column: u32 byte length, encoded values
+ *      footer      u64 offset of each block, u32 block count, u64 row count, "CHRDSESS"
+ *  Encodings:
+ *      0 varint    zigzag LEB128 of each value
+ *      1 delta     zigzag LEB128 of the difference from the previous value in the block
+ *      2 xor       LEB128 of the float's bits xored with the previous value's bits
+ *  Rows within a block are sorted by onset. Every column of a block is length-prefixed, so a
+ *  reader can skip straight past the columns it doesn't need, and the footer lets it find the
+ *  blocks without reading the file from the start.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <readerwriterqueue.h>
+
+#include "ingest.h"
+#include "tuning.h"
+#include "voices.h"
+
+class SessionRecorder : public VoiceListener
+{
+  public:
+    static constexpr uint32_t version = 1;
+    static constexpr int queueCapacity = 16384;
+    static constexpr int blockRows = 4096;
+
+    // Notes starting this close together belong to the same set, unless one stops in between
+    static constexpr int64_t chordWindowNs = 30000000;
+
+    explicit SessionRecorder(TuningTable &tuning) : tuning(tuning), queue(queueCapacity) {}
+
+    ~SessionRecorder() { stop(ingestClock()); }
+
+    // Open the file and start the writer thread; returns false if the file can't be written
+    bool start(const std::string &path)
+    {
+        file.open(path, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            std::cout << "ERROR::RECORDER::OPEN_FAILED " << path << std::endl;
+            return false;
+        }
+
+        // Session times are kept relative to the start, which is stored as wall clock time
+        startTime = ingestClock();
+        int64_t epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::system_clock::now().time_since_epoch())
+                            .count();
+
+        std::vector<uint8_t> header(magic, magic + 8);
+        put(header, version, 4);
+        put(header, epoch, 8);
+        put(header, numColumns, 4);
+        for (const Column &c : columns)
+        {
+            header.push_back(std::strlen(c.name));
+            header.insert(header.end(), c.name, c.name + std::strlen(c.name));
+            header.push_back(c.type);
+            header.push_back(c.encoding);
+        }
+        file.write((const char *)header.data(), header.size());
+
+        running = true;
+        writer = std::thread(&SessionRecorder::write, this);
+        std::cout << "Recording session to " << path << std::endl;
+        return true;
+    }
+
+    // Record notes still sounding as ending at time, then finish writing the file
+    void stop(int64_t time)
+    {
+        if (!running)
+        {
+            return;
+        }
+        for (int slot = 0; slot < maxNotes; slot++)
+        {
+            if (sounding[slot].onset >= 0)
+            {
+                finishNote(slot, time);
+            }
+        }
+        running = false;
+        writer.join();
+        file.close();
+    }
+
+    void voiceOn(int slot, const Voice &voice, int64_t time) override
+    {
+        if (!running)
+            return;
+        if (setClosed || time - lastOnset > chordWindowNs)
+        {
+            setId++;
+            setClosed = false;
+        }
+        lastOnset = time;
+        Row &r = sounding[slot];
+        r.onset = time - startTime;
+        r.channel = voice.channel;
+        r.note = voice.note;
+        r.velocity = voice.velocity;
+        r.frequency = tuning.cached(voice.channel, voice.note);
+        r.angle = voice.angle;
+        r.set = setId;
+    }
+
+    void voiceOff(int slot, const Voice &voice, int64_t time) override
+    {
+        if (!running || sounding[slot].onset < 0)
+            return;
+        setClosed = true;
+        finishNote(slot, time);
+    }
+
+    void printStats()
+    {
+        std::cout << "Recorder:" << std::endl;
+        std::cout << "    notes written: " << rowsWritten << ", dropped (queue full): " << dropped
+                  << std::endl;
+    }
+
+  private:
+    // One note, as written to the file
+    struct Row
+    {
+        int64_t onset = -1; // ns since the session started, -1 for a slot not sounding
+        int64_t duration = 0;
+        int64_t channel = 0;
+        int64_t note = 0;
+        int64_t velocity = 0;
+        double frequency = 0.0;
+        double angle = 0.0;
+        int64_t set = 0;
+    };
+
+    enum Encoding : uint8_t
+    {
+        Varint,
+        Delta,
+        Xor
+    };
+
+    struct Column
+    {
+        const char *name;
+        uint8_t type; // 0 int64, 1 float64
+        Encoding encoding;
+    };
+
+    static constexpr int numColumns = 8;
+    static constexpr Column columns[numColumns] = {
+        {"onset_ns", 0, Delta}, {"duration_ns", 0, Varint}, {"channel", 0, Varint},
+        {"note", 0, Delta},     {"velocity", 0, Varint},    {"frequency", 1, Xor},
+        {"angle", 1, Xor},      {"set", 0, Delta},
+    };
+
+    static constexpr char magic[9] = "CHRDSESS";
+
+    void finishNote(int slot, int64_t time)
+    {
+        Row r = sounding[slot];
+        r.duration = time - startTime - r.onset;
+        sounding[slot].onset = -1;
+        if (!queue.try_enqueue(r))
+        {
+            dropped++;
+        }
+    }
+
+    // Runs on the writer thread
+    void write()
+    {
+        std::vector<Row> block;
+        block.reserve(blockRows);
+        Row r;
+        while (true)
+        {
+            // Checked before dequeuing, so once stopping the queue is sure to be drained
+            bool stopping = !running;
+            bool more = queue.try_dequeue(r);
+            if (more)
+            {
+                block.push_back(r);
+            }
+            if (block.size() == blockRows || (!more && stopping && !block.empty()))
+            {
+                writeBlock(block);
+                block.clear();
+            }
+            if (!more)
+            {
+                if (stopping)
+                    break;
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            }
+        }
+
+        std::vector<uint8_t> footer;
+        for (uint64_t offset : blockOffsets)
+        {
+            put(footer, offset, 8);
+        }
+        put(footer, blockOffsets.size(), 4);
+        put(footer, rowsWritten.load(), 8);
+        footer.insert(footer.end(), magic, magic + 8);
+        file.write((const char *)footer.data(), footer.size());
+    }
+
+    void writeBlock(std::vector<Row> &block)
+    {
+        std::sort(block.begin(), block.end(),
+                  [](const Row &a, const Row &b) { return a.onset < b.onset; });
+
+        blockOffsets.push_back(file.tellp());
+        encoded.clear();
+        put(encoded, block.size(), 4);
+        for (int c = 0; c < numColumns; c++)
+        {
+            size_t lengthAt = encoded.size();
+            put(encoded, 0, 4);
+            uint64_t previous = 0;
+            for (const Row &r : block)
+            {
+                uint64_t bits = value(r, c);
+                switch (columns[c].encoding)
+                {
+                case Varint:
+                    putVarint(encoded, zigzag(bits));
+                    break;
+                case Delta:
+                    putVarint(encoded, zigzag(bits - previous));
+                    break;
+                case Xor:
+                    putVarint(encoded, bits ^ previous);
+                    break;
+                }
+                previous = bits;
+            }
+            uint32_t length = encoded.size() - lengthAt - 4;
+            for (int i = 0; i < 4; i++)
+                encoded[lengthAt + i] = length >> (8 * i);
+        }
+        file.write((const char *)encoded.data(), encoded.size());
+        rowsWritten += block.size();
+    }
+
+    // Bits of column c of a row: integers as they are, floats reinterpreted
+    static uint64_t value(const Row &r, int c)
+    {
+        switch (c)
+        {
+        case 0:
+            return r.onset;
+        case 1:
+            return r.duration;
+        case 2:
+            return r.channel;
+        case 3:
+            return r.note;
+        case 4:
+            return r.velocity;
+        case 5:
+            return std::bit_cast<uint64_t>(r.frequency);
+        case 6:
+            return std::bit_cast<uint64_t>(r.angle);
+        default:
+            return r.set;
+        }
+    }
+
+    static uint64_t zigzag(uint64_t v) { return (v << 1) ^ (uint64_t)((int64_t)v >> 63); }
+
+    static void putVarint(std::vector<uint8_t> &out, uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            out.push_back((v & 0x7F) | 0x80);
+            v >>= 7;
+        }
+        out.push_back(v);
+    }
+
+    static void put(std::vector<uint8_t> &out, uint64_t v, int bytes)
+    {
+        for (int i = 0; i < bytes; i++)
+            out.push_back(v >> (8 * i));
+    }
+
+    TuningTable &tuning;
+    int64_t startTime = 0;
+    int64_t setId = 0;
+    int64_t lastOnset = 0;
+    bool setClosed = true;
+    Row sounding[maxNotes];
+
+    moodycamel::ReaderWriterQueue<Row> queue;
+    std::thread writer;
+    std::atomic<bool> running = false;
+
+    // Only touched by the writer thread
+    std::ofstream file;
+    std::vector<uint8_t> encoded;
+    std::vector<uint64_t> blockOffsets;
+
+    std::atomic<uint64_t> rowsWritten = 0;
+    std::atomic<uint64_t> dropped = 0;
+};
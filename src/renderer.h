@@ -0,0 +1,407 @@
+/**
+ *  Renderer tiers, picked once at startup from what the GL driver supports
+ *
+ *  The shaders and draw calls are the same everywhere. What differs between tiers is how data
+ *  gets to the GPU, which is hidden behind the Renderer interface:
+ *      gl33    the baseline. Uniform buffers are rewritten with glBufferSubData and vertex
+ *              buffers with glBufferData, binding each buffer to edit it.
+ *      gl45    needs direct state access and buffer storage (core in 4.5, or the ARB
+ *              extensions). Frame and keyframe uniforms live in a persistently mapped ring of
+ *              three regions, written in place and bound with glBindBufferRange, with a fence
+ *              on each region so a frame still being drawn is never overwritten. Vertex
+ *              buffers are edited without binding.
+ *      gles30  for boards with only OpenGL ES 3.0, updating buffers as gl33 does. GLES has no
+ *              geometry shaders, so notes and edges are drawn instanced instead, and as these
+ *              GPUs render in tiles the depth and stencil buffers are invalidated at the end of
+ *              the frame so they are never written back to memory.
+ *  Every tier uploads the frame's uniforms once for all the tiles of a video wall (see tiles.h),
+ *  each tile's copy aligned so it can be bound on its own with glBindBufferRange.
+ *  The tier is chosen once, so each frame costs a virtual call per update and nothing more.
+ *  Any can be forced with --renderer for benchmarking.
+ *
+ *  glad is generated for GL 3.3, so the 4.5 functions are loaded here by hand, as are the GLES
+ *  3.0 functions glad only loads for desktop GL 3.1 and later.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include "debug.h"
+#include "glide.h"
+#include "tiles.h"
+#include "voices.h"
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+// Binding points of the uniform blocks in shaders.h
+static constexpr unsigned int keyframesBinding = 0;
+static constexpr unsigned int frameBinding = 1;
+
+// Per frame values, laid out to match the Frame uniform block in shaders.h
+struct FrameUniforms
+{
+    float tile[4];
+    float scaleX, scaleY;
+    float zoom;
+    float cameraAngle;
+    uint32_t displayTime;
+    int32_t highlightNote;
+    int32_t highlightEdge;
+    float rotation, pulse;
+    float arc;
+    int32_t consonance;
+    float padding; // std140 rounds the block up to a multiple of 16 bytes
+};
+
+static_assert(sizeof(FrameUniforms) == 64, "FrameUniforms must match the Frame block");
+
+// Round a size up to a multiple of alignment
+inline size_t alignUp(size_t size, int alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+// Space each tile's frame uniforms take in a uniform buffer, so each can be bound on its own
+inline size_t frameStride()
+{
+    int alignment;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    return alignUp(sizeof(FrameUniforms), alignment);
+}
+
+// One draw: glDrawElements when indexed, otherwise glDrawArrays, instanced when instances isn't 1
+struct DrawCall
+{
+    GLenum mode;
+    int count; // vertices, or indices when indexed
+    int instances = 1;
+    bool indexed = false;
+};
+
+// Load a GL function glad doesn't, exiting if the driver doesn't have it
+template <typename F> void loadFunction(F &f, const char *name)
+{
+    f = (F)glfwGetProcAddress(name);
+    if (f == nullptr)
+    {
+        std::cout << "ERROR::RENDERER::MISSING_FUNCTION " << name << std::endl;
+        exit(-1);
+    }
+}
+
+class Renderer
+{
+  public:
+    enum Tier
+    {
+        Auto,
+        GL33,
+        GL45,
+        GLES30
+    };
+
+    virtual ~Renderer() = default;
+
+    virtual const char *name() const = 0;
+
+    // Whether the context is GLES, which needs the GLES shader prelude and no geometry shaders
+    virtual bool es() const { return false; }
+
+    // Replace the note keyframes, which only happens when notes start, stop or move
+    virtual void updateKeyframes(const Keyframe keyframes[maxNotes]) = 0;
+
+    // Set this frame's uniforms for each of count tiles, before any drawing
+    virtual void beginFrame(const FrameUniforms frames[], int count) = 0;
+
+    // Draw with tile i's frame uniforms
+    virtual void useTile(int i) = 0;
+
+    // Called once all of the frame's drawing has been issued
+    virtual void endFrame() {}
+
+    // Replace the contents of a vertex buffer
+    virtual void updateVertices(unsigned int buffer, const void *data, size_t size) = 0;
+
+    // How to draw the edges between the first numNotes notes with the line program
+    virtual DrawCall edges(int numNotes) const
+    {
+        return DrawCall{GL_LINES, numNotes * (numNotes - 1), 1, true};
+    }
+
+    // How to draw the first numNotes notes with the point program
+    virtual DrawCall notes(int numNotes) const { return DrawCall{GL_POINTS, numNotes}; }
+};
+
+class GL33Renderer : public Renderer
+{
+  public:
+    GL33Renderer() : stride(frameStride()), staging(TileLayout::maxTiles * stride)
+    {
+        glGenBuffers(2, UBO);
+        glBindBuffer(GL_UNIFORM_BUFFER, UBO[0]);
+        glBufferData(GL_UNIFORM_BUFFER, maxNotes * sizeof(Keyframe), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, UBO[1]);
+        glBufferData(GL_UNIFORM_BUFFER, staging.size(), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, keyframesBinding, UBO[0]);
+        labelObject(GL_BUFFER, UBO[0], "Keyframes uniforms");
+        labelObject(GL_BUFFER, UBO[1], "Frame uniforms");
+    }
+
+    const char *name() const override { return "gl33"; }
+
+    void updateKeyframes(const Keyframe keyframes[maxNotes]) override
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, UBO[0]);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, maxNotes * sizeof(Keyframe), keyframes);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void beginFrame(const FrameUniforms frames[], int count) override
+    {
+        for (int i = 0; i < count; i++)
+        {
+            std::memcpy(staging.data() + i * stride, &frames[i], sizeof(FrameUniforms));
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, UBO[1]);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, count * stride, staging.data());
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void useTile(int i) override
+    {
+        glBindBufferRange(GL_UNIFORM_BUFFER, frameBinding, UBO[1], i * stride,
+                          sizeof(FrameUniforms));
+    }
+
+    void updateVertices(unsigned int buffer, const void *data, size_t size) override
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferData(GL_ARRAY_BUFFER, size, data, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+  private:
+    unsigned int UBO[2]; // keyframes, frames
+    size_t stride;
+    std::vector<uint8_t> staging; // each tile's frame uniforms, spaced out by stride
+};
+
+class GL45Renderer : public Renderer
+{
+  public:
+    static constexpr int numRegions = 3;
+
+    GL45Renderer()
+    {
+        loadFunction(createBuffers, "glCreateBuffers");
+        loadFunction(namedBufferStorage, "glNamedBufferStorage");
+        loadFunction(mapNamedBufferRange, "glMapNamedBufferRange");
+        loadFunction(namedBufferData, "glNamedBufferData");
+
+        // Each region holds the frame uniforms of every tile then the keyframes, each aligned
+        // as the driver requires for glBindBufferRange
+        int alignment;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        stride = frameStride();
+        keyframesOffset = TileLayout::maxTiles * stride;
+        regionSize = alignUp(keyframesOffset + maxNotes * sizeof(Keyframe), alignment);
+
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        createBuffers(1, &UBO);
+        namedBufferStorage(UBO, numRegions * regionSize, NULL, flags);
+        mapped = (uint8_t *)mapNamedBufferRange(UBO, 0, numRegions * regionSize, flags);
+        labelObject(GL_BUFFER, UBO, "Uniform ring");
+    }
+
+    const char *name() const override { return "gl45"; }
+
+    void updateKeyframes(const Keyframe k[maxNotes]) override
+    {
+        std::memcpy(keyframes, k, sizeof(keyframes));
+        keyframesVersion++;
+    }
+
+    void beginFrame(const FrameUniforms frames[], int count) override
+    {
+        // Wait until the GPU has finished with the frame that last used this region, which is
+        // normally long done as it was two frames ago
+        if (fences[region] != nullptr)
+        {
+            glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+            glDeleteSync(fences[region]);
+            fences[region] = nullptr;
+        }
+
+        uint8_t *base = mapped + region * regionSize;
+        for (int i = 0; i < count; i++)
+        {
+            std::memcpy(base + i * stride, &frames[i], sizeof(FrameUniforms));
+        }
+        if (regionVersion[region] != keyframesVersion)
+        {
+            std::memcpy(base + keyframesOffset, keyframes, sizeof(keyframes));
+            regionVersion[region] = keyframesVersion;
+        }
+
+        glBindBufferRange(GL_UNIFORM_BUFFER, keyframesBinding, UBO,
+                          region * regionSize + keyframesOffset, sizeof(keyframes));
+    }
+
+    void useTile(int i) override
+    {
+        glBindBufferRange(GL_UNIFORM_BUFFER, frameBinding, UBO, region * regionSize + i * stride,
+                          sizeof(FrameUniforms));
+    }
+
+    void endFrame() override
+    {
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        region = (region + 1) % numRegions;
+    }
+
+    void updateVertices(unsigned int buffer, const void *data, size_t size) override
+    {
+        namedBufferData(buffer, size, data, GL_DYNAMIC_DRAW);
+    }
+
+  private:
+    void(APIENTRY *createBuffers)(GLsizei, GLuint *) = nullptr;
+    void(APIENTRY *namedBufferStorage)(GLuint, GLsizeiptr, const void *, GLbitfield) = nullptr;
+    void *(APIENTRY *mapNamedBufferRange)(GLuint, GLintptr, GLsizeiptr, GLbitfield) = nullptr;
+    void(APIENTRY *namedBufferData)(GLuint, GLsizeiptr, const void *, GLenum) = nullptr;
+
+    unsigned int UBO = 0;
+    uint8_t *mapped = nullptr;
+    size_t stride = 0;
+    size_t keyframesOffset = 0;
+    size_t regionSize = 0;
+
+    int region = 0;
+    GLsync fences[numRegions] = {nullptr, nullptr, nullptr};
+
+    // Latest keyframes, copied into each region the first time it is used after they change
+    Keyframe keyframes[maxNotes];
+    uint64_t keyframesVersion = 1;
+    uint64_t regionVersion[numRegions] = {0, 0, 0};
+};
+
+class GLES30Renderer : public GL33Renderer
+{
+  public:
+    // Vertices of each note's disc, see pointInstancedVertexShaderSource
+    static constexpr int discVertices = 34;
+
+    GLES30Renderer()
+    {
+        loadFunction(glad_glDrawArraysInstanced, "glDrawArraysInstanced");
+        loadFunction(glad_glGetUniformBlockIndex, "glGetUniformBlockIndex");
+        loadFunction(glad_glUniformBlockBinding, "glUniformBlockBinding");
+        loadFunction(glad_glVertexAttribDivisor, "glVertexAttribDivisor");
+        loadFunction(glad_glFenceSync, "glFenceSync");
+        loadFunction(glad_glClientWaitSync, "glClientWaitSync");
+        loadFunction(glad_glDeleteSync, "glDeleteSync");
+        loadFunction(invalidateFramebuffer, "glInvalidateFramebuffer");
+    }
+
+    const char *name() const override { return "gles30"; }
+
+    bool es() const override { return true; }
+
+    void endFrame() override
+    {
+        // Only the colour buffer needs to leave the tile memory
+        GLenum attachments[2] = {GL_DEPTH, GL_STENCIL};
+        invalidateFramebuffer(GL_FRAMEBUFFER, 2, attachments);
+    }
+
+    DrawCall edges(int numNotes) const override
+    {
+        return DrawCall{GL_TRIANGLE_STRIP, 4, numNotes * (numNotes - 1) / 2};
+    }
+
+    DrawCall notes(int numNotes) const override
+    {
+        return DrawCall{GL_TRIANGLE_FAN, discVertices, numNotes};
+    }
+
+  private:
+    void(APIENTRY *invalidateFramebuffer)(GLenum, GLsizei, const GLenum *) = nullptr;
+};
+
+// Whether the current context supports an extension
+inline bool hasExtension(const char *name)
+{
+    int count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (int i = 0; i < count; i++)
+    {
+        if (std::strcmp((const char *)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Best tier the current context supports
+inline Renderer::Tier detectTier()
+{
+    if (std::strncmp((const char *)glGetString(GL_VERSION), "OpenGL ES", 9) == 0)
+    {
+        return Renderer::GLES30;
+    }
+    int major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    if (major > 4 || (major == 4 && minor >= 5))
+    {
+        return Renderer::GL45;
+    }
+    if (hasExtension("GL_ARB_direct_state_access") && hasExtension("GL_ARB_buffer_storage"))
+    {
+        return Renderer::GL45;
+    }
+    return Renderer::GL33;
+}
+
+// Create the renderer for a tier, or the best available for Auto
+inline Renderer *createRenderer(Renderer::Tier tier)
+{
+    Renderer::Tier available = detectTier();
+    if (tier == Renderer::Auto)
+    {
+        tier = available;
+    }
+    // gl33 runs on any desktop context, the others only on their own
+    if (tier != available && !(tier == Renderer::GL33 && available == Renderer::GL45))
+    {
+        std::cout << "ERROR::RENDERER::NOT_SUPPORTED " << glGetString(GL_VERSION) << std::endl;
+        exit(-1);
+    }
+    Renderer *renderer = nullptr;
+    switch (tier)
+    {
+    case Renderer::GL45:
+        renderer = new GL45Renderer();
+        break;
+    case Renderer::GLES30:
+        renderer = new GLES30Renderer();
+        break;
+    default:
+        renderer = new GL33Renderer();
+    }
+    std::cout << "Renderer: " << renderer->name() << " (" << glGetString(GL_RENDERER) << ", "
+              << glGetString(GL_VERSION) << ")" << std::endl;
+    return renderer;
+}
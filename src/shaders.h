@@ -1,24 +1,112 @@
 // GLSL source code for all shaders used
+//
+// Sources leave out the version line, and are compiled with one of these in front of them
+// depending on whether the context is desktop GL or GLES (see compileShaders in main.cpp)
+std::string desktopPrelude = "#version 330 core\n";
+std::string computePrelude = "#version 430 core\n";
+std::string esPrelude = "#version 300 es\nprecision highp float;\nprecision highp int;\n";
+
+// Values which change from frame to frame, shared by several shaders (see FrameUniforms in
+// renderer.h)
+std::string frameSource = R"(
+
+layout(std140) uniform Frame
+{
+    vec4 tile;             // scale and offset from the canvas to the tile drawn (see tiles.h)
+    float scaleX, scaleY;  // aspect ratio correction
+    float zoom;            // camera zoom (see camera.h)
+    float cameraAngle;     // camera angle, only used for the circle's ripple pattern
+    uint displayTime;      // when the frame will be shown, in microseconds
+    int highlightNote;     // index of the note under the mouse, or -1
+    int highlightEdge;     // index of the edge under the mouse, or -1
+    float rotation, pulse; // circle animation
+    float arc;             // half the angle of the arc on screen
+    int consonance;        // whether edges are weighted by consonance (see metrics.h)
+};
+
+// Position in the tile being drawn of a point on the canvas
+vec4 tilePosition(vec2 canvas) { return vec4(canvas * tile.xy + tile.zw, 1.0, 1.0); }
+
+// Whether a box, in the tile's coordinates, lies entirely outside the tile
+bool outsideTile(vec2 low, vec2 high)
+{
+    return any(greaterThan(low, vec2(1.0))) || any(lessThan(high, vec2(-1.0)));
+}
 
-std::string pointVertexShaderSource = R"(
+)";
 
-#version 330 core
+// Position on screen of an angle given as an offset from the camera angle (see camera.h)
+std::string cameraSource = R"(
 
-uniform float scaleX, scaleY;
-uniform float noteAngles[16];
+vec2 circlePosition(float offset, float radius)
+{
+    float s = sin(offset);
+    float h = sin(0.5 * offset);
+    // Point on the circle relative to the camera's point, scaled by the zoom, then moved
+    // outwards by any difference in radius without scaling
+    return vec2(0.0, 0.8 / zoom) + zoom * 0.8 * vec2(s, -2.0 * h * h) +
+           (radius - 0.8) * vec2(s, 1.0 - 2.0 * h * h);
+}
 
-void main()
+)";
+
+// Offset from the camera of note i at the time the frame is shown, from its keyframe (see
+// glide.h)
+std::string noteAngleSource = cameraSource + R"(
+
+layout(std140) uniform Keyframes
 {
-    gl_Position = vec4(scaleX * (0.8 * sin(noteAngles[gl_VertexID])),
-                       scaleY * (0.8 * cos(noteAngles[gl_VertexID])), 1.0, 1.0);
+    uvec4 keyframes[16]; // from offset, to offset, start and end in microseconds
+};
+
+float noteAngle(int i)
+{
+    uvec4 k = keyframes[i];
+    float length = max(float(k.w - k.z), 1.0);
+    float t = clamp(float(int(displayTime - k.z)) / length, 0.0, 1.0);
+    return mix(uintBitsToFloat(k.x), uintBitsToFloat(k.y), t);
 }
 
 )";
 
-std::string pointGeometryShaderSource = R"(
+// Size of each note's disc, which stands for several notes when near-coincident notes are
+// clustered (see clusters.h)
+std::string noteRadiusSource = R"(
+
+uniform float multiplicity[16];
+
+// Radius of note i's disc, with area proportional to the number of notes it stands for
+float noteRadius(int i) { return (i == highlightNote ? 0.035 : 0.02) * sqrt(multiplicity[i]); }
+
+)";
+
+// Consonance of each edge's interval, worked out when pitches change (see metrics.h)
+std::string edgeMetricsSource = R"(
+
+layout(std140) uniform EdgeMetrics
+{
+    vec4 edgeMetrics[120]; // consonance weight, error in cents, complexity, unused
+};
+
+// Half width of edge k, wider the more consonant its interval when weighting is on
+float edgeWidth(int k)
+{
+    float r = k == highlightEdge ? 0.02 : 0.01;
+    return consonance != 0 ? r * (0.5 + edgeMetrics[k].x) : r;
+}
+
+)";
 
-#version 330 core
+std::string pointVertexShaderSource = frameSource + noteAngleSource + R"(
+void main()
+{
+    vec2 p = circlePosition(noteAngle(gl_VertexID), 0.8);
+    gl_Position = tilePosition(vec2(scaleX * p.x, scaleY * p.y));
+}
 
+)";
+
+std::string pointGeometryShaderSource = frameSource + noteRadiusSource + R"(
 #define TWOPI 6.283185307179586
 #define N 60
 #define TWONPLUSONE 121
@@ -26,19 +114,23 @@ std::string pointGeometryShaderSource = R"(
 layout(points) in;
 layout(triangle_strip, max_vertices = TWONPLUSONE) out;
 
-uniform float scaleX, scaleY;
-
 void main()
 {
     int i;
-    float r = 0.02;
+    float r = noteRadius(gl_PrimitiveIDIn);
+    vec2 c = gl_in[0].gl_Position.xy;
+    vec2 radius = tile.xy * vec2(scaleX, scaleY) * r;
+
+    // Discs entirely outside this tile are left out
+    if (outsideTile(c - radius, c + radius))
+        return;
+
     float theta0 = TWOPI / N;
     float theta = 0.0;
     for (i = 0; i <= N; i++)
     {
         theta = i * theta0;
-        gl_Position =
-            gl_in[0].gl_Position + vec4(scaleX * r * cos(theta), scaleY * r * sin(theta), 0.0, 0.0);
+        gl_Position = gl_in[0].gl_Position + vec4(radius * vec2(cos(theta), sin(theta)), 0.0, 0.0);
         EmitVertex();
         gl_Position = gl_in[0].gl_Position;
         EmitVertex();
@@ -48,52 +140,111 @@ void main()
 
 )";
 
+// Instanced versions of the point and line shaders, for GLES which has no geometry shaders
+
+std::string pointInstancedVertexShaderSource =
+    frameSource + noteAngleSource + noteRadiusSource + R"(
+#define TWOPI 6.283185307179586
+#define N 32
+
+// One instance per note, a disc drawn as a triangle fan of the centre then N + 1 points round
+// the edge, so no pixel is drawn twice
+void main()
+{
+    vec2 p = circlePosition(noteAngle(gl_InstanceID), 0.8);
+    float r = noteRadius(gl_InstanceID);
+    vec2 c = tilePosition(vec2(scaleX * p.x, scaleY * p.y)).xy;
+    vec2 radius = tile.xy * vec2(scaleX, scaleY) * r;
+    float theta = TWOPI * float(gl_VertexID - 1) / float(N);
+    vec2 d = gl_VertexID == 0 ? vec2(0.0) : radius * vec2(cos(theta), sin(theta));
+    gl_Position = vec4(c + d, 1.0, 1.0);
+
+    // Discs entirely outside this tile collapse to a point outside it
+    if (outsideTile(c - radius, c + radius))
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+}
+
+)";
+
+std::string lineInstancedVertexShaderSource =
+    frameSource + noteAngleSource + edgeMetricsSource + R"(
+out float color;
+
+#define PI 3.141592653589793
+
+void main()
+{
+    // One instance per edge, a quad with corners numbered
+    //     0 2
+    //     1 3
+    // Edge k joins notes i < j, where k = j * (j - 1) / 2 + i as in the indices table
+    int k = gl_InstanceID;
+    int j = int((1.0 + sqrt(1.0 + 8.0 * float(k))) / 2.0);
+    if (j * (j - 1) / 2 > k)
+        j--;
+    if (j * (j + 1) / 2 <= k)
+        j++;
+    int i = k - j * (j - 1) / 2;
+
+    float phi1 = noteAngle(i);
+    float phi2 = noteAngle(j);
+
+    float x = mod(abs(phi2 - phi1) / PI, 2.0);
+    color = x < 1.0 ? x : 2.0 - x;
+
+    float theta = phi1 + (phi2 - phi1) / 2.0;
+    float r = edgeWidth(k);
+    vec2 scale = vec2(scaleX, scaleY);
+    vec2 d = tile.xy * scale * r * vec2(sin(theta), cos(theta));
+    vec2 a = tilePosition(scale * circlePosition(phi1, 0.8)).xy;
+    vec2 b = tilePosition(scale * circlePosition(phi2, 0.8)).xy;
+    gl_Position = vec4((gl_VertexID < 2 ? a : b) + (gl_VertexID % 2 == 0 ? d : -d), 1.0, 1.0);
+
+    // Edges entirely outside this tile collapse to a point outside it
+    if (outsideTile(min(a, b) - abs(d), max(a, b) + abs(d)))
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+}
+
+)";
+
 std::string pointFragmentShaderSource = R"(
 
-#version 330 core
 out vec4 FragColor;
 
 void main() { FragColor = vec4(1.0); }
 
 )";
 
-std::string circleVertexShaderSource = R"(
-
-#version 330 core
-layout(location = 0) in vec3 aPos;
-
-uniform float scaleX, scaleY, time;
+std::string circleVertexShaderSource = frameSource + cameraSource + R"(
+#define N 1024
 
+// The circle is generated along the visible arc, so it stays smooth at any zoom
 void main()
 {
-    float c = cos(0.01 * time);
-    float s = sin(0.01 * time);
-    gl_Position =
-        vec4(scaleX * (aPos.x * c + aPos.y * s), scaleY * (-aPos.x * s + aPos.y * c), 1.0, 1.0);
+    float offset = arc * (2.0 * float(gl_VertexID / 2) / float(N) - 1.0);
+    float d = abs(0.01 * sin(60.0 * (cameraAngle + offset - rotation)));
+    float r = 0.8 + 0.016 * pulse + (gl_VertexID % 2 == 0 ? d : -d);
+    vec2 p = circlePosition(offset, r);
+    gl_Position = tilePosition(vec2(scaleX * p.x, scaleY * p.y));
 }
 
 )";
 
 std::string circleFragmentShaderSource = R"(
 
-#version 330 core
 out vec4 FragColor;
 
 void main() { FragColor = vec4(0.5, 0.5, 0.5, 1.0); }
 
 )";
 
-std::string lineGeometryShaderSource = R"(
-
-#version 330 core
+std::string lineGeometryShaderSource =
+    frameSource + noteAngleSource + edgeMetricsSource + R"(
 layout(lines) in;
 layout(triangle_strip, max_vertices = 4) out;
 
 out float color;
 
-uniform float scaleX, scaleY;
-uniform float noteAngles[16];
-
 #define PI 3.141592653589793
 
 void main()
@@ -223,8 +374,8 @@ void main()
     );
     // clang-format on
 
-    float phi1 = noteAngles[indices[2 * gl_PrimitiveIDIn]];
-    float phi2 = noteAngles[indices[2 * gl_PrimitiveIDIn + 1]];
+    float phi1 = noteAngle(indices[2 * gl_PrimitiveIDIn]);
+    float phi2 = noteAngle(indices[2 * gl_PrimitiveIDIn + 1]);
 
     float x = mod(abs(phi2 - phi1) / PI, 2.0);
     color = x < 1 ? x : 2 - x;
@@ -233,8 +384,15 @@ void main()
     float costheta = cos(theta);
     float sintheta = sin(theta);
 
-    float r = 0.01;
-    vec4 d = vec4(scaleX * r * sintheta, scaleY * r * costheta, 0.0, 0.0);
+    float r = edgeWidth(gl_PrimitiveIDIn);
+    vec4 d = vec4(tile.xy * vec2(scaleX * r * sintheta, scaleY * r * costheta), 0.0, 0.0);
+
+    // Edges entirely outside this tile are left out
+    vec2 a = gl_in[0].gl_Position.xy;
+    vec2 b = gl_in[1].gl_Position.xy;
+    if (outsideTile(min(a, b) - abs(d.xy), max(a, b) + abs(d.xy)))
+        return;
+
     gl_Position = gl_in[0].gl_Position + d;
     EmitVertex();
     gl_Position = gl_in[0].gl_Position - d;
@@ -250,7 +408,6 @@ void main()
 
 std::string lineFragmentShaderSource = R"(
 
-#version 330 core
 out vec4 FragColor;
 in float color;
 
@@ -259,3 +416,145 @@ uniform sampler2D rainbow;
 void main() { FragColor = texture(rainbow, vec2(0.5, 1.0 - color)); }
 
 )";
+
+std::string barVertexShaderSource = frameSource + R"(
+out float color;
+
+uniform float heights[61];
+
+#define NBARS 61
+#define LEFT -0.95
+#define RIGHT 0.95
+#define BOTTOM -0.98
+#define HEIGHT 0.15
+
+void main()
+{
+    // One instance per bar, drawn as a triangle strip with corners numbered
+    //     1 3
+    //     0 2
+    float width = (RIGHT - LEFT) / float(NBARS);
+    float x = LEFT + width * (float(gl_InstanceID) + 0.1 + 0.8 * float(gl_VertexID / 2));
+    float y = BOTTOM + HEIGHT * heights[gl_InstanceID] * float(gl_VertexID % 2);
+    color = float(gl_InstanceID) / float(NBARS - 1);
+    gl_Position = tilePosition(vec2(x, y));
+}
+
+)";
+
+std::string latticeNodeVertexShaderSource = frameSource + R"(
+layout(location = 0) in vec2 aCenter;
+out vec2 local;
+
+uniform vec4 panel; // centre x, y and half width, height of the lattice panel
+
+#define R 0.06
+
+void main()
+{
+    // One instance per node, a square with corners numbered
+    //     1 3
+    //     0 2
+    local = vec2(gl_VertexID / 2, gl_VertexID % 2) * 2.0 - 1.0;
+    gl_Position = tilePosition(panel.xy + panel.zw * (aCenter + R * local));
+}
+
+)";
+
+std::string latticeNodeFragmentShaderSource = R"(
+
+in vec2 local;
+out vec4 FragColor;
+
+void main()
+{
+    // Round the square off into a disc
+    if (dot(local, local) > 1.0)
+        discard;
+    FragColor = vec4(1.0);
+}
+
+)";
+
+std::string latticeEdgeVertexShaderSource = frameSource + R"(
+layout(location = 0) in vec4 aEnds;
+
+uniform vec4 panel;
+
+#define W 0.015
+
+void main()
+{
+    // One instance per edge, a thin quad from one end to the other
+    vec2 along = aEnds.zw - aEnds.xy;
+    vec2 across = W * normalize(vec2(-along.y, along.x));
+    vec2 p = aEnds.xy + along * float(gl_VertexID / 2) + across * float(gl_VertexID % 2 * 2 - 1);
+    gl_Position = tilePosition(panel.xy + panel.zw * p);
+}
+
+)";
+
+// Compute shader filling the EdgeMetrics buffer from note pitches, with GL 4.3 (see metrics.h).
+// It matches nearestJustRatio in lattice.h and consonanceWeight in metrics.h
+std::string edgeMetricsComputeShaderSource = R"(
+layout(local_size_x = 64) in;
+
+layout(std430, binding = 0) readonly buffer Notes
+{
+    int numNotes;
+    float cents[16];
+};
+
+layout(std430, binding = 1) writeonly buffer EdgeMetrics
+{
+    vec4 edgeMetrics[120];
+};
+
+#define LOG3 1.584962500721156
+#define LOG5 2.321928094887362
+#define LOG7 2.807354922057604
+
+void main()
+{
+    // Edge k joins notes i < j, where k = j * (j - 1) / 2 + i as in the indices table
+    int k = int(gl_GlobalInvocationID.x);
+    if (k >= numNotes * (numNotes - 1) / 2)
+        return;
+    int j = int((1.0 + sqrt(1.0 + 8.0 * float(k))) / 2.0);
+    if (j * (j - 1) / 2 > k)
+        j--;
+    if (j * (j + 1) / 2 <= k)
+        j++;
+    int i = k - j * (j - 1) / 2;
+
+    float interval = cents[j] - cents[i];
+    float reduced = interval - 1200.0 * floor(interval / 1200.0);
+
+    // Nearest 7-limit ratio, scored by error plus twice the log of its Tenney height
+    float bestScore = 1e9, bestError = 0.0, bestComplexity = 0.0;
+    for (int e3 = -4; e3 <= 4; e3++)
+        for (int e5 = -2; e5 <= 2; e5++)
+            for (int e7 = -1; e7 <= 1; e7++)
+            {
+                float complexity = abs(float(e3)) * LOG3 + abs(float(e5)) * LOG5 +
+                                   abs(float(e7)) * LOG7;
+                float c = 1200.0 * (float(e3) * LOG3 + float(e5) * LOG5 + float(e7) * LOG7);
+                float e2 = -floor(c / 1200.0);
+                c += 1200.0 * e2;
+                float error = reduced - c;
+                error -= 1200.0 * round(error / 1200.0);
+                float score = abs(error) + 2.0 * (abs(e2) + complexity);
+                if (score < bestScore)
+                {
+                    bestScore = score;
+                    bestError = error;
+                    bestComplexity = complexity;
+                }
+            }
+
+    float e = bestError / 20.0;
+    float weight = exp2(-bestComplexity / 4.0) * exp(-e * e);
+    edgeMetrics[k] = vec4(weight, bestError, bestComplexity, 0.0);
+}
+
+)";
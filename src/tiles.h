@@ -0,0 +1,87 @@
+/**
+ *  Splitting the picture across a video wall
+ *
+ *  For a wall of projectors or screens driven as one canvas, the window (usually stretched
+ *  across all the outputs) is divided into a grid of equal tiles, one per output. Bezels, or
+ *  gaps between projected images, are allowed for by leaving out a band of the canvas between
+ *  neighbouring tiles, so lines crossing from one output to the next stay straight.
+ *
+ *  The canvas is everything the tiles show plus the bands hidden between them, and positions on
+ *  it run from -1 to 1 across each axis as normalized device coordinates do. Shaders place
+ *  everything on the canvas, and each tile's transform takes that into the tile's own normalized
+ *  device coordinates, so each tile is drawn with its own viewport and transform. The notes'
+ *  data is uploaded once per frame and shared by every tile.
+ *
+ *  With one tile and no bezel the canvas is simply the window.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+struct TileLayout
+{
+    static constexpr int maxTiles = 16;
+
+    int columns = 1;
+    int rows = 1;
+    int bezel = 0; // framebuffer pixels hidden between neighbouring tiles
+
+    int count() const { return columns * rows; }
+
+    // Size the tiles to fit a framebuffer
+    void resize(int width, int height)
+    {
+        tileWidth = std::max(1, width / columns);
+        tileHeight = std::max(1, height / rows);
+    }
+
+    // Size of the canvas in framebuffer pixels, including the bands hidden by bezels
+    double canvasWidth() const { return columns * tileWidth + (columns - 1) * bezel; }
+    double canvasHeight() const { return rows * tileHeight + (rows - 1) * bezel; }
+
+    // Viewport of tile i in the framebuffer, numbered across from the bottom left
+    void viewport(int i, int &x, int &y, int &width, int &height) const
+    {
+        x = (i % columns) * tileWidth;
+        y = (i / columns) * tileHeight;
+        width = tileWidth;
+        height = tileHeight;
+    }
+
+    // Scale and offset taking canvas positions into tile i's normalized device coordinates
+    void transform(int i, float out[4]) const
+    {
+        // Centre and half size of the tile on the canvas
+        double x = ((i % columns) * (tileWidth + bezel) + 0.5 * tileWidth) / canvasWidth();
+        double y = ((i / columns) * (tileHeight + bezel) + 0.5 * tileHeight) / canvasHeight();
+        double halfWidth = tileWidth / canvasWidth();
+        double halfHeight = tileHeight / canvasHeight();
+        out[0] = 1.0 / halfWidth;
+        out[1] = 1.0 / halfHeight;
+        out[2] = -(2.0 * x - 1.0) / halfWidth;
+        out[3] = -(2.0 * y - 1.0) / halfHeight;
+    }
+
+    // Canvas position of a point in the window, given as fractions of its width and height from
+    // the top left as the mouse position is
+    void windowToCanvas(double u, double v, double &x, double &y) const
+    {
+        double fromLeft = toCanvas(u * columns * tileWidth, tileWidth, columns);
+        double fromBottom = toCanvas((1.0 - v) * rows * tileHeight, tileHeight, rows);
+        x = 2.0 * fromLeft / canvasWidth() - 1.0;
+        y = 2.0 * fromBottom / canvasHeight() - 1.0;
+    }
+
+  private:
+    // Canvas pixel of a framebuffer pixel along one axis, skipping the bands between tiles
+    double toCanvas(double pixel, int size, int count) const
+    {
+        int tile = std::clamp((int)std::floor(pixel / size), 0, count - 1);
+        return pixel + tile * bezel;
+    }
+
+    int tileWidth = 1;
+    int tileHeight = 1;
+};
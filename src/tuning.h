@@ -0,0 +1,55 @@
+/**
+ *  Cached tuning table
+ *
+ *  Holds the frequency MTS-ESP gives for every (channel, note). MTS-ESP doesn't say when the
+ *  tuning changes, so each note-on compares the live frequency with the cached one, and a
+ *  mismatch refreshes the whole table and bumps the generation. Anything derived from the
+ *  tuning, like lattice positions, keeps the generation it was built from and rebuilds itself
+ *  when that goes stale, so the derived tables are rebuilt once per tuning change rather than
+ *  per note.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include <libMTSClient.h>
+
+class TuningTable
+{
+  public:
+    explicit TuningTable(MTSClient *client) : client(client) { refresh(); }
+
+    // Frequency of a note, refreshing the table if the tuning has changed
+    double frequency(int channel, int note)
+    {
+        double freq = MTS_NoteToFrequency(client, note, channel);
+        if (freq != frequencies[channel][note])
+        {
+            refresh();
+        }
+        return freq;
+    }
+
+    // Cached frequency of a note, without checking for tuning changes
+    double cached(int channel, int note) const { return frequencies[channel][note]; }
+
+    // Incremented each time the tuning changes
+    uint64_t generation = 0;
+
+  private:
+    void refresh()
+    {
+        for (int channel = 0; channel < 16; channel++)
+        {
+            for (int note = 0; note < 128; note++)
+            {
+                frequencies[channel][note] = MTS_NoteToFrequency(client, note, channel);
+            }
+        }
+        generation++;
+    }
+
+    MTSClient *client;
+    double frequencies[16][128];
+};
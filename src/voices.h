@@ -0,0 +1,390 @@
+/**
+ *  Voice allocation for the notes shown on the pitch circle
+ *
+ *  Each held note occupies one of maxNotes voice slots. When all slots are in use a new note
+ *  either gets dropped or steals a voice, depending on the overflow policy:
+ *      drop-newest     ignore the new note
+ *      steal-oldest    replace the voice that started (or was released) longest ago
+ *      steal-quietest  replace the voice with the lowest velocity
+ *      steal-farthest  replace the voice farthest round the circle from the chord's centroid
+ *
+ *  Voices are split into two groups: notes whose key is still down, and notes whose key has
+ *  been released but which are held by the sustain or sostenuto pedal. Pedal-held voices are
+ *  always stolen first.
+ *
+ *  Each group keeps intrusive structures threaded through the voice slots themselves, so no
+ *  allocation happens after construction:
+ *      an age list (doubly linked, oldest at the head)         - O(1) oldest victim
+ *      velocity buckets with a 128-bit occupancy mask          - O(1) quietest victim
+ *      slots sorted by angle                                   - O(log n) farthest victim
+ *
+ *  Notes come from one of several sources: the local midi ports, or another instance sharing
+ *  its notes (see network.h). Keys and pedals are kept apart for each channel of each source, so
+ *  two players on channel 1 don't release or hold each other's notes.
+ *
+ *  Anything which needs to follow the set of sounding notes (analysis, rendering, export) can
+ *  register a VoiceListener to hear about each voice as it starts and stops.
+ */
+
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#ifndef TWOPI
+#define TWOPI 6.283185307179586
+#endif
+
+// Maximum number of simultaneously displayable notes
+static constexpr int maxNotes = 16;
+
+// Number of edges between them
+static constexpr int maxEdges = maxNotes * (maxNotes - 1) / 2;
+
+// Sources of notes: the local midi ports, then one for each instance sharing notes with us
+static constexpr int maxSources = 17;
+
+// Index of a channel of a source, for per channel state kept apart for each source
+inline int sourceChannel(int source, int channel) { return source * 16 + channel; }
+
+enum class OverflowPolicy
+{
+    DropNewest,
+    StealOldest,
+    StealQuietest,
+    StealFarthest
+};
+
+// A sounding note
+struct Voice
+{
+    bool active = false;
+    bool sostenuto = false;
+    uint8_t group = 0;
+    uint8_t source = 0; // 0 for the local midi ports, or 1 + the index of a peer
+    uint8_t channel = 0;
+    uint8_t note = 0;
+    uint8_t velocity = 0;
+    double angle = 0.0; // wrapped into [0, 2pi)
+    int64_t onset = 0; // latency compensated time of the note-on, in nanoseconds
+
+    // Intrusive links used by Voices, as slot indices (-1 for none)
+    int16_t agePrev = -1, ageNext = -1;
+    int16_t velPrev = -1, velNext = -1;
+};
+
+// Interface for following voices as they start and stop
+class VoiceListener
+{
+  public:
+    virtual void voiceOn(int slot, const Voice &voice, int64_t time) = 0;
+    virtual void voiceOff(int slot, const Voice &voice, int64_t time) = 0;
+};
+
+class Voices
+{
+  public:
+    explicit Voices(OverflowPolicy policy = OverflowPolicy::StealOldest) : policy(policy)
+    {
+        slotForKey.fill(-1);
+        for (int i = 0; i < maxNotes; i++)
+        {
+            freeSlots[i] = maxNotes - 1 - i;
+        }
+        numFree = maxNotes;
+    }
+
+    int size() const { return maxNotes - numFree; }
+
+    void addListener(VoiceListener *listener) { listeners.push_back(listener); }
+
+    // Start a note, stealing a voice if the overflow policy allows it
+    void noteOn(int source, int channel, int note, int velocity, double angle, int64_t time)
+    {
+        int key = sourceChannel(source, channel) * 128 + note;
+        if (slotForKey[key] >= 0)
+        {
+            // Retriggered note (e.g. replayed while held by the pedal) starts afresh
+            release(slotForKey[key], time);
+        }
+        if (numFree == 0)
+        {
+            if (policy == OverflowPolicy::DropNewest)
+            {
+                return;
+            }
+            release(selectVictim(), time);
+        }
+
+        int slot = freeSlots[--numFree];
+        Voice &v = voices[slot];
+        v.active = true;
+        v.source = source;
+        v.channel = channel;
+        v.note = note;
+        v.velocity = velocity;
+        v.angle = angle;
+        v.onset = time;
+        v.sostenuto = false;
+        slotForKey[key] = slot;
+        sumSin += std::sin(angle);
+        sumCos += std::cos(angle);
+        insert(slot, KeyHeld);
+        for (VoiceListener *listener : listeners)
+        {
+            listener->voiceOn(slot, v, time);
+        }
+    }
+
+    // End a note, unless it is being held by a pedal
+    void noteOff(int source, int channel, int note, int64_t time)
+    {
+        int c = sourceChannel(source, channel);
+        int slot = slotForKey[c * 128 + note];
+        if (slot < 0 || voices[slot].group != KeyHeld)
+        {
+            return;
+        }
+        if (sustain[c] || voices[slot].sostenuto)
+        {
+            remove(slot);
+            insert(slot, PedalHeld);
+        }
+        else
+        {
+            release(slot, time);
+        }
+    }
+
+    // Track sustain (CC 64) and sostenuto (CC 66) pedals
+    void controlChange(int source, int channel, int controller, int value, int64_t time)
+    {
+        int c = sourceChannel(source, channel);
+        bool down = value >= 64;
+        if (controller == 64)
+        {
+            sustain[c] = down;
+            if (!down)
+            {
+                releasePedalHeld(c, time);
+            }
+        }
+        else if (controller == 66 && down != sostenutoDown[c])
+        {
+            sostenutoDown[c] = down;
+            for (Voice &v : voices)
+            {
+                if (v.active && sourceChannel(v.source, v.channel) == c)
+                {
+                    // Sostenuto latches only the notes whose keys are down when it is pressed
+                    v.sostenuto = down && v.group == KeyHeld;
+                }
+            }
+            if (!down && !sustain[c])
+            {
+                releasePedalHeld(c, time);
+            }
+        }
+    }
+
+    // Copy the angles of all active voices into out, returning how many were written
+    int angles(double out[]) const
+    {
+        int n = 0;
+        for (const Voice &v : voices)
+        {
+            if (v.active)
+            {
+                out[n++] = v.angle;
+            }
+        }
+        return n;
+    }
+
+    const Voice &operator[](int slot) const { return voices[slot]; }
+
+  private:
+    enum Group : uint8_t
+    {
+        PedalHeld,
+        KeyHeld
+    };
+
+    struct GroupIndex
+    {
+        int16_t ageHead = -1, ageTail = -1;
+        std::array<int16_t, 128> velHead;
+        uint64_t velMask[2] = {0, 0};
+        std::array<int16_t, maxNotes> byAngle;
+        int count = 0;
+
+        GroupIndex() { velHead.fill(-1); }
+    };
+
+    // Angle wrapped into [0, 2pi), used to order voices round the circle
+    static double wrapped(double angle)
+    {
+        double a = std::fmod(angle, TWOPI);
+        return a < 0.0 ? a + TWOPI : a;
+    }
+
+    // Index of the first slot in g.byAngle whose angle is not less than a
+    int lowerBound(const GroupIndex &g, double a) const
+    {
+        int lo = 0, hi = g.count;
+        while (lo < hi)
+        {
+            int mid = (lo + hi) / 2;
+            if (wrapped(voices[g.byAngle[mid]].angle) < a)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    void insert(int slot, Group group)
+    {
+        Voice &v = voices[slot];
+        GroupIndex &g = groups[group];
+        v.group = group;
+
+        // Newest voice goes at the tail of the age list
+        v.agePrev = g.ageTail;
+        v.ageNext = -1;
+        if (g.ageTail >= 0)
+            voices[g.ageTail].ageNext = slot;
+        else
+            g.ageHead = slot;
+        g.ageTail = slot;
+
+        // Push onto the front of its velocity bucket
+        v.velPrev = -1;
+        v.velNext = g.velHead[v.velocity];
+        if (v.velNext >= 0)
+            voices[v.velNext].velPrev = slot;
+        g.velHead[v.velocity] = slot;
+        g.velMask[v.velocity / 64] |= uint64_t(1) << (v.velocity % 64);
+
+        int i = lowerBound(g, wrapped(v.angle));
+        std::memmove(&g.byAngle[i + 1], &g.byAngle[i], (g.count - i) * sizeof(int16_t));
+        g.byAngle[i] = slot;
+        g.count++;
+    }
+
+    void remove(int slot)
+    {
+        Voice &v = voices[slot];
+        GroupIndex &g = groups[v.group];
+
+        if (v.agePrev >= 0)
+            voices[v.agePrev].ageNext = v.ageNext;
+        else
+            g.ageHead = v.ageNext;
+        if (v.ageNext >= 0)
+            voices[v.ageNext].agePrev = v.agePrev;
+        else
+            g.ageTail = v.agePrev;
+
+        if (v.velPrev >= 0)
+            voices[v.velPrev].velNext = v.velNext;
+        else
+            g.velHead[v.velocity] = v.velNext;
+        if (v.velNext >= 0)
+            voices[v.velNext].velPrev = v.velPrev;
+        if (g.velHead[v.velocity] < 0)
+            g.velMask[v.velocity / 64] &= ~(uint64_t(1) << (v.velocity % 64));
+
+        int i = lowerBound(g, wrapped(v.angle));
+        while (g.byAngle[i] != slot)
+            i++;
+        std::memmove(&g.byAngle[i], &g.byAngle[i + 1], (g.count - i - 1) * sizeof(int16_t));
+        g.count--;
+    }
+
+    // Remove a voice entirely and return its slot to the free list
+    void release(int slot, int64_t time)
+    {
+        Voice &v = voices[slot];
+        for (VoiceListener *listener : listeners)
+        {
+            listener->voiceOff(slot, v, time);
+        }
+        remove(slot);
+        v.active = false;
+        slotForKey[sourceChannel(v.source, v.channel) * 128 + v.note] = -1;
+        freeSlots[numFree++] = slot;
+        if (numFree == maxNotes)
+        {
+            // Reset the centroid sums whenever the circle empties so rounding can't accumulate
+            sumSin = 0.0;
+            sumCos = 0.0;
+        }
+        else
+        {
+            sumSin -= std::sin(v.angle);
+            sumCos -= std::cos(v.angle);
+        }
+    }
+
+    // Release the notes of a source's channel held only by pedals no longer down
+    void releasePedalHeld(int c, int64_t time)
+    {
+        int slot = groups[PedalHeld].ageHead;
+        while (slot >= 0)
+        {
+            const Voice &v = voices[slot];
+            int next = v.ageNext;
+            if (sourceChannel(v.source, v.channel) == c && !(sustain[c] || v.sostenuto))
+            {
+                release(slot, time);
+            }
+            slot = next;
+        }
+    }
+
+    // Pick the voice to steal, taking pedal-held voices first
+    int selectVictim() const
+    {
+        const GroupIndex &g = groups[groups[PedalHeld].count > 0 ? PedalHeld : KeyHeld];
+        switch (policy)
+        {
+        case OverflowPolicy::StealQuietest:
+        {
+            int velocity = g.velMask[0] ? std::countr_zero(g.velMask[0])
+                                        : 64 + std::countr_zero(g.velMask[1]);
+            return g.velHead[velocity];
+        }
+        case OverflowPolicy::StealFarthest:
+        {
+            // The farthest voice from the centroid is the one nearest its antipode
+            double antipode = wrapped(std::atan2(sumSin, sumCos) + TWOPI / 2);
+            int i = lowerBound(g, antipode);
+            int after = g.byAngle[i % g.count];
+            int before = g.byAngle[(i + g.count - 1) % g.count];
+            auto distance = [&](int slot) {
+                double d = std::abs(wrapped(voices[slot].angle) - antipode);
+                return std::min(d, TWOPI - d);
+            };
+            return distance(after) <= distance(before) ? after : before;
+        }
+        default:
+            return g.ageHead;
+        }
+    }
+
+    OverflowPolicy policy;
+    std::array<Voice, maxNotes> voices;
+    std::array<GroupIndex, 2> groups;
+    std::array<int16_t, maxSources * 16 * 128> slotForKey;
+    std::array<int16_t, maxNotes> freeSlots;
+    int numFree;
+    double sumSin = 0.0, sumCos = 0.0;
+    bool sustain[maxSources * 16] = {false};
+    bool sostenutoDown[maxSources * 16] = {false};
+    std::vector<VoiceListener *> listeners;
+};